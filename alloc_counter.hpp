@@ -0,0 +1,44 @@
+#pragma once
+#include <gmp.h>
+#include <atomic>
+#include <cstddef>
+
+
+namespace alloc
+{
+
+    // Heap allocations GMP, and MPFR through it, made since install_gmp_counter().
+    inline std::atomic<unsigned long int> gmp_allocations = 0;
+
+    namespace detail
+    {
+        inline void* (*gmp_allocate)(size_t) = nullptr;
+        inline void* (*gmp_reallocate)(void*, size_t, size_t) = nullptr;
+        inline void  (*gmp_free)(void*, size_t) = nullptr;
+
+        inline void* counting_allocate(size_t size)
+        {
+            gmp_allocations.fetch_add(1, std::memory_order_relaxed);
+            return gmp_allocate(size);
+        }
+
+        inline void* counting_reallocate(void* pointer, size_t old_size, size_t new_size)
+        {
+            gmp_allocations.fetch_add(1, std::memory_order_relaxed);
+            return gmp_reallocate(pointer, old_size, new_size);
+        }
+    }
+
+    // Route GMP's allocations through the counter. The counting functions hand on to the previous ones,
+    // so values allocated before this call are still freed correctly.
+    inline void install_gmp_counter()
+    {
+        if (detail::gmp_allocate != nullptr)
+        {
+            return;
+        }
+        mp_get_memory_functions(&detail::gmp_allocate, &detail::gmp_reallocate, &detail::gmp_free);
+        mp_set_memory_functions(detail::counting_allocate, detail::counting_reallocate, detail::gmp_free);
+    }
+
+}
@@ -17,14 +17,37 @@
 #include "./mpreal.h"
 #include <queue>
 #include <condition_variable>
+#include <complex>
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <tuple>
+#include <span>
+#include <array>
+#include <optional>
+#include <string_view>
+#include <numeric>
 #include "thread_pool.hpp"
+#include "precision.hpp"
+#include "perturbation.hpp"
+#include "simd_kernel.hpp"
+#include "tile_scheduler.hpp"
+#include "framebuffer.hpp"
+#include "mpfr_kernel.hpp"
+#include "alloc_counter.hpp"
+#include "frame_encoder.hpp"
+#include "image_writer.hpp"
+#include "frame_metrics.hpp"
+#include "glyphs.hpp"
+#include "tile_cache.hpp"
+#include "tile_store.hpp"
 
 using mpfr::mpreal;
 
 bool DEBUG = false;
 
-// Will use all available threads, reserving 2, one for drawing and one for input.
-const uint32_t num_threads = std::thread::hardware_concurrency() - 2;
+// Will use all available threads, reserving 2, one for drawing and one for input. Always at least one worker.
+const uint32_t num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 2);
 
 //
 // Mandelbrot object containing the function that calculates each point.
@@ -54,8 +77,24 @@ class Mandelbrot
 
     // Zoom Factor - The area gets multiplied by this in order to shrink
     mpreal zoom_factor;
-    mpreal half_zoom;
-    mpreal zoom_out_factor;
+
+    // Zoom steps taken from the base size, so the plane is base_width by base_height times zoom_factor^zoom_level.
+    // Counting steps instead of scaling the size by each one brings zooming out back to exactly the sizes it zoomed in through.
+    long int zoom_level = 0;
+    mpreal base_width;
+    mpreal base_height;
+
+    // The cells of every zoom level lie on a lattice from this origin, which stays put while the view pans and zooms,
+    // so a view seen before lands on the same points again and its cells can come from the tile cache.
+    // lattice_x and lattice_y count the cells from the origin to the view's top left one. A new origin gets a new id.
+    mpreal anchor_real;
+    mpreal anchor_imag;
+    uint64_t lattice = 0;
+    long int lattice_x = 0;
+    long int lattice_y = 0;
+
+    // Lattice indices further than this from the origin no longer fit the counts, the origin moves to the view instead.
+    static constexpr double max_lattice_index = 1e15;
 
     // The factor which when multiplied by each dimension gives 
     // the distance to move the plane in x or y. 
@@ -65,47 +104,471 @@ class Mandelbrot
     mpreal transl_x;
     mpreal transl_y;
 
+    // The same in cells.
+    long int transl_columns = 1;
+    long int transl_rows = 1;
+
+    // Size of the character grid the plane is rendered onto, set by the renderer.
+    long int columns = 1;
+    long int rows = 1;
+
+    // Bits the view is kept at, following the zoom. See fit_precision.
+    mpfr_prec_t working_precision = 0;
+
     std::atomic<bool> changed = true;
 
-    // Mandelbrot orbit calculator. Checks when it converges or shoots off, max is maxIterations. 
-    int calculate_point(mpreal realc, mpreal imaginaryc)
+    // Bumped by every change, so work started for an older view can tell it is obsolete.
+    std::atomic<uint64_t> generation = 0;
+
+    // Everything a frame is rendered from, copied under the lock so the view can keep changing while it renders.
+    struct View
     {
-        int iter_count = 0;
+        mpreal real_min;
+        mpreal imag_min;
+        mpreal width;
+        mpreal height;
+        mpreal real_coordinate;
+        mpreal imag_coordinate;
+        long int max_iterations = 0;
+        int required_bits = 0;
+        uint64_t generation = 0;
+
+        // Where the view's cells are on the lattice.
+        uint64_t lattice = 0;
+        long int zoom_level = 0;
+        long int lattice_x = 0;
+        long int lattice_y = 0;
+    };
+
+    // Lets the renderer sleep until the view changes.
+    std::mutex changed_mutex;
+    std::condition_variable changed_cv;
+    std::chrono::steady_clock::time_point changed_at = std::chrono::steady_clock::now();
+
+    // Whether c lies in the main cardioid or the period 2 bulb, where no orbit ever escapes.
+    template<typename Real>
+    static bool in_cardioid_or_bulb(const Real& realc, const Real& imaginaryc)
+    {
+        const Real y2 = imaginaryc * imaginaryc;
+        const Real xq = realc - 0.25;
+        const Real q = xq * xq + y2;
+        const Real xb = realc + 1.0;
+        return q * (q + xq) - y2 * 0.25 < 0.0 || xb * xb + y2 - 0.0625 < 0.0;
+    }
+
+    // Mandelbrot orbit calculator. Checks when it converges or shoots off, max is max_iterations. 
+    // Real is the arithmetic backend chosen for the frame: double, long double, dd_real or mpreal.
+    // Continues from `orbit` after iter_count iterations, or from z = 0 when iter_count is 0, and leaves
+    // the orbit's last z there. Also hands back |z|^2 at escape, for smooth shading.
+    // Bounded points exit early, either analytically for the cardioid and bulb, or once Brent's method
+    // finds the orbit back within a few units in the last place of a value it had before.
+    template<typename Real>
+    int calculate_point(const Real& realc, const Real& imaginaryc, framebuffer::OrbitState<Real>& orbit, int iter_count, long int max_iterations, double& norm, framebuffer::Outcome& outcome)
+    {
+        norm = 0.0;
+        if (in_cardioid_or_bulb(realc, imaginaryc))
+        {
+            outcome = framebuffer::Outcome::Cardioid;
+            return iter_count;
+        }
+
+        Real zx = iter_count == 0 ? precision::zero_like(realc) : orbit.zx;
+        Real zy = iter_count == 0 ? zx : orbit.zy;
+
+        Real xsqr = zx * zx;
+        Real ysqr = zy * zy;
+
+        const Real tolerance = precision::periodicity_tolerance(realc);
+        Real saved_x = zx;
+        Real saved_y = zy;
+        long int period = 1;
+        long int steps = 0;
+
+        while(iter_count < max_iterations && xsqr + ysqr < 4.0)
+        {
+            zy *= zx;
+            zy += zy + imaginaryc;
+            zx = xsqr - ysqr + realc;
+            xsqr = zx * zx;
+            ysqr = zy * zy;
+            iter_count++;
+
+            if (precision::within(zx, saved_x, tolerance) && precision::within(zy, saved_y, tolerance))
+            {
+                outcome = framebuffer::Outcome::Periodic;
+                return iter_count;
+            }
+            if (++steps == period)
+            {
+                saved_x = zx;
+                saved_y = zy;
+                steps = 0;
+                period *= 2;
+            }
+        }
+        norm = precision::to_double(xsqr + ysqr);
+        outcome = norm < 4.0 ? framebuffer::Outcome::Bounded : framebuffer::Outcome::Escaped;
+        orbit.zx = zx;
+        orbit.zy = zy;
+        return iter_count;
+    }
+
+    // Escape radius distance estimation iterates to, |z| = 256. The potential the distance is estimated from,
+    // log|z| / 2^n, is only close to the true one well outside the set.
+    static constexpr double distance_escape_norm = 65536.0;
+
+    // Distance estimation also takes a cell as interior once its orbit comes back this close to where it was,
+    // with the multiplier of the cycle, the derivative of the orbit by z over it, showing the cycle attracting.
+    // Brent's exact test would have to wait for the orbit to settle to the last place.
+    static constexpr double interior_tolerance = 0x1p-24;
+    static constexpr double interior_multiplier = 0.5;
+
+    // Lower bound on the distance from c to the set, in the units of the derivative dz/dc, for an orbit that escaped
+    // after n iterations with |z|^2 = norm: sinh(G) / (2 e^G |G'|) with the potential G = log|z| / 2^n.
+    static double distance_bound(long int iterations, double norm, double derivative_norm)
+    {
+        if (!(derivative_norm > 0.0) || std::isinf(derivative_norm))
+        {
+            return 0.0;
+        }
+        const double log_z = 0.5 * std::log(norm);
+        const double potential = std::ldexp(log_z, -static_cast<int>(std::min(iterations, 2000L)));
+        const double factor = potential > 0.0 ? -std::expm1(-2.0 * potential) / (2.0 * potential) : 1.0;
+        return factor * std::sqrt(norm) * log_z / (2.0 * std::sqrt(derivative_norm));
+    }
 
-        mpreal zx, zy;
-        zx = "0";
-        zy = "0";
+    // calculate_point for distance estimation. Also carries dz/dc, scaled to cells of width `cell`, which gives escaped
+    // points their distance to the set, and the derivative by z since Brent's last saved point, which is the multiplier
+    // of a cycle through it. The derivatives are doubles whatever Real is: they only need to be roughly right, and
+    // one too large to hold means a distance of zero. Always starts from z = 0 and keeps nothing of the orbit.
+    template<typename Real>
+    int calculate_point_de(const Real& realc, const Real& imaginaryc, double cell, long int max_iterations, double& norm, double& distance, framebuffer::Outcome& outcome)
+    {
+        norm = 0.0;
+        distance = 0.0;
+        if (in_cardioid_or_bulb(realc, imaginaryc))
+        {
+            outcome = framebuffer::Outcome::Cardioid;
+            return 0;
+        }
 
-        mpreal xsqr, ysqr;
-        xsqr = "0";
-        ysqr = "0";
+        Real zx = precision::zero_like(realc);
+        Real zy = zx;
+        Real xsqr = zx * zx;
+        Real ysqr = zy * zy;
+        double dcr = 0.0, dci = 0.0;
+        double dzr = 1.0, dzi = 0.0;
+
+        const Real tolerance = precision::periodicity_tolerance(realc);
+        Real saved_x = zx;
+        Real saved_y = zy;
+        long int period = 1;
+        long int steps = 0;
+        int iter_count = 0;
 
-        while(iter_count < maxIterations && xsqr + ysqr < 4.0)
+        while(iter_count < max_iterations && precision::to_double(xsqr + ysqr) < distance_escape_norm)
         {
+            const double x = precision::to_double(zx);
+            const double y = precision::to_double(zy);
+            const double dcr_next = 2.0 * (x * dcr - y * dci) + cell;
+            dci = 2.0 * (x * dci + y * dcr);
+            dcr = dcr_next;
+            const double dzr_next = 2.0 * (x * dzr - y * dzi);
+            dzi = 2.0 * (x * dzi + y * dzr);
+            dzr = dzr_next;
+
             zy *= zx;
             zy += zy + imaginaryc;
             zx = xsqr - ysqr + realc;
             xsqr = zx * zx;
             ysqr = zy * zy;
             iter_count++;
+
+            const bool settled = precision::within(zx, saved_x, tolerance) && precision::within(zy, saved_y, tolerance);
+            const bool attracted = std::abs(precision::to_double(zx - saved_x)) < interior_tolerance && std::abs(precision::to_double(zy - saved_y)) < interior_tolerance
+                                && dzr * dzr + dzi * dzi < interior_multiplier;
+            if (settled || attracted)
+            {
+                outcome = framebuffer::Outcome::Periodic;
+                return iter_count;
+            }
+            if (++steps == period)
+            {
+                saved_x = zx;
+                saved_y = zy;
+                dzr = 1.0;
+                dzi = 0.0;
+                steps = 0;
+                period *= 2;
+            }
+        }
+        norm = precision::to_double(xsqr + ysqr);
+        outcome = norm < distance_escape_norm ? framebuffer::Outcome::Bounded : framebuffer::Outcome::Escaped;
+        if (outcome == framebuffer::Outcome::Escaped)
+        {
+            distance = distance_bound(iter_count, norm, dcr * dcr + dci * dci);
+        }
+        return iter_count;
+    }
+
+    // Vectorized orbit calculator for a run of points on one row, in doubles. All of them continue from
+    // start_iterations and the z they are given, which is updated in place.
+    void calculate_row(simd::RowKernel kernel, const double* realc, double imaginaryc, long int count, long int start_iterations, long int max_iterations,
+                       int* iterations, double* zx, double* zy, double* norms, framebuffer::Outcome* outcomes)
+    {
+        kernel(realc, imaginaryc, count, start_iterations, max_iterations, iterations, zx, zy, norms, outcomes);
+    }
+
+    // MPFR orbit calculator on a worker's preallocated registers, see mpfr_kernel::escape.
+    // The caller loads c and the starting z into the registers.
+    int calculate_point_mpfr(mpfr_kernel::Scratch& registers, int iter_count, long int max_iterations, double& norm, framebuffer::Outcome& outcome)
+    {
+        return mpfr_kernel::escape(registers, iter_count, max_iterations, norm, outcome);
+    }
+
+    // Perturbed orbit calculator. Only the offset dz of this point's orbit from the reference orbit Z is
+    // iterated, in doubles: dz' = 2*Z*dz + dz^2 + dc. Whenever |Z + dz| < |dz| the delta is about to lose
+    // its precision (a glitch), so the orbit is rebased onto the start of the reference with dz = Z + dz.
+    // The same happens when the reference itself escapes before this point does.
+    // A fresh point takes its first series.skip iterations from the series approximation instead of iterating
+    // them, one that is continued starts from the delta and reference index left in `orbit`.
+    int calculate_perturbed(const perturbation::ReferenceOrbit& reference, const perturbation::SeriesApproximation& series, double dcr, double dci,
+                            framebuffer::OrbitState<double>& orbit, int iter_count, long int max_iterations, double& norm, framebuffer::Outcome& outcome, long int& rebases)
+    {
+        norm = 0.0;
+        long int ref_iter = orbit.ref_iter;
+        const long int ref_last = reference.last();
+
+        double dzr = orbit.zx;
+        double dzi = orbit.zy;
+        if (iter_count == 0)
+        {
+            const std::complex<double> dz = series.evaluate(dcr, dci);
+            dzr = dz.real();
+            dzi = dz.imag();
+            iter_count = series.skip;
+            ref_iter = series.skip;
+        }
+
+        while(iter_count < max_iterations)
+        {
+            const double Zr = reference.real[ref_iter];
+            const double Zi = reference.imag[ref_iter];
+
+            const double dzr_next = 2.0 * (Zr * dzr - Zi * dzi) + (dzr * dzr - dzi * dzi) + dcr;
+            dzi = 2.0 * (Zr * dzi + Zi * dzr) + 2.0 * dzr * dzi + dci;
+            dzr = dzr_next;
+            ref_iter++;
+            iter_count++;
+
+            const double zr = reference.real[ref_iter] + dzr;
+            const double zi = reference.imag[ref_iter] + dzi;
+            const double z_norm = zr * zr + zi * zi;
+            norm = z_norm;
+            if (z_norm >= 4.0)
+            {
+                break;
+            }
+
+            if (z_norm < dzr * dzr + dzi * dzi || ref_iter == ref_last)
+            {
+                dzr = zr;
+                dzi = zi;
+                ref_iter = 0;
+                rebases++;
+            }
+        }
+        outcome = norm >= 4.0 ? framebuffer::Outcome::Escaped : framebuffer::Outcome::Bounded;
+        orbit.zx = dzr;
+        orbit.zy = dzi;
+        orbit.ref_iter = ref_iter;
+        return iter_count;
+    }
+
+    // calculate_perturbed for distance estimation, see calculate_point_de. The derivatives follow the full orbit Z + dz.
+    // Starts from z = 0 without the series approximation, which has no derivative to hand over, and keeps nothing of the orbit.
+    int calculate_perturbed_de(const perturbation::ReferenceOrbit& reference, double dcr, double dci, double cell, long int max_iterations,
+                               double& norm, double& distance, framebuffer::Outcome& outcome, long int& rebases)
+    {
+        norm = 0.0;
+        distance = 0.0;
+        long int ref_iter = 0;
+        const long int ref_last = reference.last();
+
+        double dzr = 0.0, dzi = 0.0;
+        double der = 0.0, dei = 0.0;
+        double mr = 1.0, mi = 0.0;
+        double saved_x = 0.0, saved_y = 0.0;
+        long int period = 1;
+        long int steps = 0;
+        int iter_count = 0;
+
+        while(iter_count < max_iterations)
+        {
+            const double Zr = reference.real[ref_iter];
+            const double Zi = reference.imag[ref_iter];
+            const double x = Zr + dzr;
+            const double y = Zi + dzi;
+            const double der_next = 2.0 * (x * der - y * dei) + cell;
+            dei = 2.0 * (x * dei + y * der);
+            der = der_next;
+            const double mr_next = 2.0 * (x * mr - y * mi);
+            mi = 2.0 * (x * mi + y * mr);
+            mr = mr_next;
+
+            const double dzr_next = 2.0 * (Zr * dzr - Zi * dzi) + (dzr * dzr - dzi * dzi) + dcr;
+            dzi = 2.0 * (Zr * dzi + Zi * dzr) + 2.0 * dzr * dzi + dci;
+            dzr = dzr_next;
+            ref_iter++;
+            iter_count++;
+
+            const double zr = reference.real[ref_iter] + dzr;
+            const double zi = reference.imag[ref_iter] + dzi;
+            const double z_norm = zr * zr + zi * zi;
+            norm = z_norm;
+            if (z_norm >= distance_escape_norm)
+            {
+                break;
+            }
+
+            if (std::abs(zr - saved_x) < interior_tolerance && std::abs(zi - saved_y) < interior_tolerance && mr * mr + mi * mi < interior_multiplier)
+            {
+                outcome = framebuffer::Outcome::Periodic;
+                return iter_count;
+            }
+            if (++steps == period)
+            {
+                saved_x = zr;
+                saved_y = zi;
+                mr = 1.0;
+                mi = 0.0;
+                steps = 0;
+                period *= 2;
+            }
+
+            if (z_norm < dzr * dzr + dzi * dzi || ref_iter == ref_last)
+            {
+                dzr = zr;
+                dzi = zi;
+                ref_iter = 0;
+                rebases++;
+            }
+        }
+        outcome = norm >= distance_escape_norm ? framebuffer::Outcome::Escaped : framebuffer::Outcome::Bounded;
+        if (outcome == framebuffer::Outcome::Escaped)
+        {
+            distance = distance_bound(iter_count, norm, der * der + dei * dei);
         }
         return iter_count;
     }
 
     // Calculate translation distance at each level.
+    // Snapped to whole cells, so after a pan the cells still on screen line up with the previous frame.
     void set_translation_distance()
     {
-        transl_x = width * transl_factor;
-        transl_y = height * transl_factor;
+        transl_columns = std::max(1L, std::lround(transl_factor.toDouble() * columns));
+        transl_rows = std::max(1L, std::lround(transl_factor.toDouble() * rows));
+        transl_x = (width / columns) * transl_columns;
+        transl_y = (height / rows) * transl_rows;
+    }
+
+    // Called by the renderer whenever the buffer size changes.
+    void set_grid(long int grid_columns, long int grid_rows)
+    {
+        if (grid_columns != columns || grid_rows != rows)
+        {
+            columns = std::max(1L, grid_columns);
+            rows = std::max(1L, grid_rows);
+            place();
+        }
+    }
+
+    // Bits needed to tell two neighbouring cells apart, guard bits included.
+    int required_bits() const
+    {
+        const mpreal magnitude = std::max(abs(real_coordinate), abs(imag_coordinate)) + std::max(width, height);
+        return precision::required_bits(std::min(width / columns, height / rows), magnitude);
+    }
+
+    // Keep the view at the precision the zoom needs instead of a fixed default, MPFR's cost per operation grows with it.
+    // Edges and sizes are rounded to it, the coordinates never drop bits they carry, so zooming back in returns to the same point.
+    void fit_precision()
+    {
+        working_precision = std::max(precision::double_bits, required_bits());
+        for (mpreal* value : {&real_min, &real_max, &imag_min, &imag_max, &width, &height, &transl_x, &transl_y})
+        {
+            value->set_prec(working_precision);
+        }
+        for (mpreal* value : {&real_coordinate, &imag_coordinate, &anchor_real, &anchor_imag})
+        {
+            value->set_prec(std::max(working_precision, mpfr_min_prec(value->mpfr_srcptr())));
+        }
+    }
+
+    // Start a new lattice at the view's top left corner.
+    void reanchor()
+    {
+        anchor_real = real_coordinate - width * 0.5;
+        anchor_imag = imag_coordinate - height * 0.5;
+        lattice++;
+        lattice_x = 0;
+        lattice_y = 0;
+    }
+
+    // Edges of the plane from the view's place on the lattice.
+    void set_edges()
+    {
+        real_min = anchor_real + (width / columns) * lattice_x;
+        real_max = real_min + width;
+        imag_min = anchor_imag + (height / rows) * lattice_y;
+        imag_max = imag_min + height;
+        for (mpreal* value : {&real_min, &real_max, &imag_min, &imag_max})
+        {
+            value->set_prec(working_precision);
+        }
+    }
+
+    // Size the plane for the zoom level and center it on the coordinate, as near as the lattice cell the top left corner snaps to allows.
+    void place()
+    {
+        const mpreal scale = pow(zoom_factor, zoom_level);
+        width = base_width * scale;
+        height = base_height * scale;
+        fit_precision();
+
+        mpreal cells_x = (real_coordinate - width * 0.5 - anchor_real) / (width / columns);
+        mpreal cells_y = (imag_coordinate - height * 0.5 - anchor_imag) / (height / rows);
+        if (abs(cells_x) > max_lattice_index || abs(cells_y) > max_lattice_index)
+        {
+            reanchor();
+            fit_precision();
+            cells_x = 0;
+            cells_y = 0;
+        }
+        lattice_x = cells_x.toLong(MPFR_RNDN);
+        lattice_y = cells_y.toLong(MPFR_RNDN);
+
+        set_edges();
+        set_translation_distance();
+    }
+
+    // Make the current size zoom level 0, on a new lattice.
+    void rebase()
+    {
+        base_width = width;
+        base_height = height;
+        zoom_level = 0;
+        reanchor();
+        place();
     }
 
     // Move viewport up around the point. 
     void move_up()
     {
         std::unique_lock lock(mutex);
-        imag_min -= transl_y;
-        imag_max += transl_y;
+        lattice_y -= transl_rows;
         imag_coordinate -= transl_y;
+        set_edges();
         update();
     }
     
@@ -113,9 +576,9 @@ class Mandelbrot
     void move_down()
     {
         std::unique_lock lock(mutex);
-        imag_min += transl_y;
-        imag_max -= transl_y;
+        lattice_y += transl_rows;
         imag_coordinate += transl_y;
+        set_edges();
         update();
     }
 
@@ -123,9 +586,9 @@ class Mandelbrot
     void move_left()
     {
         std::unique_lock lock(mutex);
-        real_min -= transl_x;
-        real_max += transl_x;
+        lattice_x -= transl_columns;
         real_coordinate -= transl_x;
+        set_edges();
         update();
     }
 
@@ -133,93 +596,89 @@ class Mandelbrot
     void move_right()
     {
         std::unique_lock lock(mutex);
-        real_min += transl_x;
-        real_max -= transl_x;
+        lattice_x += transl_columns;
         real_coordinate += transl_x;
+        set_edges();
         update();
     }
 
-    // Zoom into the mandelbrot by reducing the height of the viewport around the center point.
+    // Zoom into the mandelbrot one level, shrinking the area by zoom_factor around the center point.
     void zoom()
     {
         std::unique_lock lock(mutex);
-        // Zooming is done by reducing the area calculated by zoom_factor, then adding each 
-        // half of the new area to each side of the coordenate that is centered. Thus always zooming around the chosen coordinate.
-        mpreal half_width, half_height;
-
-        /*  
-            I use half of the factor to immediately get the half width with only one multiplication.
-            That way i do not have to multiply by the zoom factor then divide by 2. In order to-
-            add each half to each side of the coordinate, thereby ensuring the movements are always centered.
-        */
-        half_width = width * half_zoom;
-        real_min =  real_coordinate - half_width;
-        real_max = real_coordinate + half_width;
-
-        half_height = height * half_zoom;
-        imag_min = imag_coordinate - half_height;
-        imag_max = imag_coordinate + half_height;
-
-        width = half_width * 2;
-        height = half_height * 2;
-        
-        set_translation_distance();
+        zoom_level++;
+        place();
         update();
     }
 
-    // Zoom out of the mandelbrot by reducing the hight of the viewport around the center point.
+    // Zoom out of the mandelbrot one level, back to the size it had one zoom in before.
     void zoom_out()
     {
         std::unique_lock lock(mutex);
-        mpreal half_width, half_height;
-
-        half_width = width * zoom_out_factor;
-        real_min =  real_coordinate - half_width;
-        real_max = real_coordinate + half_width;
-
-        half_height = height * zoom_out_factor;
-        imag_min = imag_coordinate - half_height;
-        imag_max = imag_coordinate + half_height;
-
-        width = half_width * 2;
-        height = half_height * 2;
-        
-        set_translation_distance();
+        zoom_level--;
+        place();
         update();
     }
 
-    // Center viewport around specified coords.
+    // Center viewport around specified coords. The lattice stays, so coming back to a point finds its cells again.
     void set_coords(mpreal real, mpreal imag)
     {
         std::unique_lock lock(mutex);
         real_coordinate = real;	
         imag_coordinate = imag;
-        
-        mpreal half_width, half_height;
-
-        half_width = width * 0.5;
-        real_min =  real_coordinate - half_width;
-        real_max = real_coordinate + half_width;
-
-        half_height = height * 0.5;
-        imag_min = imag_coordinate - half_height;
-        imag_max = imag_coordinate + half_height;
-
-        set_translation_distance();
+        place();
         update();
     }
     
+    // Set the size of the plane shown, around the current center.
+    void set_extent(mpreal plane_width, mpreal plane_height)
+    {
+        std::unique_lock lock(mutex);
+        width = plane_width;
+        height = plane_height;
+        rebase();
+        update();
+    }
+
+    // Set the factor each zoom in scales the plane by, zooming out scales it back by its inverse.
+    void set_zoom_factor(mpreal factor)
+    {
+        std::unique_lock lock(mutex);
+        zoom_factor = factor;
+        rebase();
+    }
+
+    // Cells keep their orbits, so raising the limit only continues the ones that are still bounded.
     void set_max_iterations(int i)
     {
+        std::unique_lock lock(mutex);
         maxIterations = i;
         update();
     }
 
-    bool updated()
+    // Fit the plane to the renderer's grid and take the view a frame is rendered from.
+    View snapshot(long int grid_columns, long int grid_rows)
+    {
+        std::unique_lock lock(mutex);
+        set_grid(grid_columns, grid_rows);
+        return {real_min, imag_min, width, height, real_coordinate, imag_coordinate, maxIterations, required_bits(), generation,
+                lattice, zoom_level, lattice_x, lattice_y};
+    }
+
+    // Whether a change arrived since the view was taken.
+    bool outdated(const View& view) const
+    {
+        return generation != view.generation;
+    }
+
+    // Take the pending change, if there is one, and when the oldest change it covers arrived.
+    bool updated(std::chrono::steady_clock::time_point& since)
     {
+        std::lock_guard lock(changed_mutex);
         if (changed)
         {
             changed = false;
+            since = changed_at;
             return true;
         }
         return false;
@@ -227,7 +686,23 @@ class Mandelbrot
 
     void update()
     {
-        changed = true;
+        generation++;
+        {
+            std::lock_guard lock(changed_mutex);
+            if (!changed)
+            {
+                changed_at = std::chrono::steady_clock::now();
+            }
+            changed = true;
+        }
+        changed_cv.notify_all();
+    }
+
+    // Block until the view changes or the timeout passes. Returns whether there is something to render.
+    bool wait_for_update(std::chrono::milliseconds timeout)
+    {
+        std::unique_lock lock(changed_mutex);
+        return changed_cv.wait_for(lock, timeout, [this](){ return changed.load(); });
     }
 
     Mandelbrot()
@@ -237,28 +712,20 @@ class Mandelbrot
         imag_coordinate = "0";
         
         // Set factor of the screen area to zoom by.
-        // Screen will be zoomed out by the inverse of this factor (1 - zoom_factor).
+        // Screen will be zoomed out by the inverse of this factor.
         zoom_factor = "0.9";
         
         // Set translation factor, will move screen horz and vert by this factor.
         transl_factor = 0.06;
 
-        // Set visible area.
-        real_min = "-3";
-        real_max = "3";
-        imag_min = "-2";
-        imag_max = "2";
-        
-        // Calculate the dimensions of the area.
-        height = imag_max - imag_min;
-	    width = real_max - real_min;
-        
-        // Calculate plane movement distances.
-        set_translation_distance();
+        // Set visible area, which is zoom level 0, and the lattice from its top left corner.
+        base_width = "6";
+        base_height = "4";
+        anchor_real = "-3";
+        anchor_imag = "-2";
         
-        // Calculate zoom factors.
-        half_zoom = zoom_factor * 0.5;
-        zoom_out_factor = (1 + (1 - zoom_factor)) * 0.5;
+        // Calculate the edges, precision and plane movement distances.
+        place();
     }
 };
 
@@ -269,68 +736,154 @@ class Display
 {
     public:
     std::thread thread;
-    bool terminate = false;
+    std::atomic<bool> terminate = false;
+
+    // One shaded frame and the stats printed under it.
+    struct Frame
+    {
+        long int width = 0;
+        long int height = 0;
+        std::vector<char32_t> cells;
+        std::string stats;
+
+        // Renderer's number for the frame, 0 for ones it does not keep metrics of.
+        uint64_t id = 0;
+    };
+
+    // How long printing a frame took and the bytes it sent, stats included.
+    struct Written
+    {
+        uint64_t id = 0;
+        std::chrono::nanoseconds time{0};
+        size_t bytes = 0;
+    };
+
+    // Triple buffer between the renderer and the output thread. The renderer shades the back frame and publishes
+    // it by swapping it into the ready slot, the output thread swaps the frame it last printed for the ready one.
+    // Each swap is one atomic exchange of a frame index, tagged fresh while the ready frame is unprinted.
+    static constexpr unsigned int fresh = 4;
+    std::array<Frame, 3> frames;
+    std::atomic<unsigned int> ready = 2;
+    unsigned int back = 0;
+    unsigned int front = 1;
 
-    // Mutex for utilizing screen sizes. Prevents overflow when resizing.
-    std::mutex draw_mutex;
+    // Bumped for everything the output thread has to act on: a new frame, a cleared screen or a stop.
+    std::atomic<uint32_t> signals = 0;
 
-    // Editable buffer.
-    std::vector<char> buffer;
+    // Set when the terminal's contents are unknown, the output thread then sends the next frame whole.
+    std::atomic<bool> invalidated = false;
 
-    // Display buffer.
-    std::vector<char> display_buffer;
+    // Serializes writes to the terminal between the output thread and status messages from the user interface.
+    std::mutex output_mutex;
 
-    // Buffer dimmensions.    
-    long int buffer_width;
-    long int buffer_height;
-    long int buffer_length;
+    // Size of the terminal's drawing area, read by the renderer at the start of each frame.
+    std::atomic<long int> buffer_width = 0;
+    std::atomic<long int> buffer_height = 0;
 
-    // 
-    std::chrono::time_point<std::chrono::system_clock> shade_start_time = std::chrono::system_clock::now();
-    std::chrono::time_point<std::chrono::system_clock> frame_start_time = std::chrono::system_clock::now();
+    // Sends each frame as its differences from the one on screen.
+    terminal::FrameEncoder encoder;
 
-    // Variable for screen info details.
+    // Stats last printed under the frame.
     std::string stats = "";
     int status_lines = 1;
 
-    // Draw whole display buffer at position 1, 1 of terminal.
-    void draw_display_buffer()
+    // Last numbered frame printed.
+    std::mutex written_mutex;
+    Written written;
+
+    // Frame the renderer shades into, sized to the given grid.
+    Frame& back_frame(long int width, long int height)
+    {
+        Frame& frame = frames[back];
+        frame.width = width;
+        frame.height = height;
+        frame.cells.resize(width * height);
+        return frame;
+    }
+
+    // Hand the back frame to the output thread and take the ready one as the new back frame.
+    void present(std::string frame_stats, uint64_t id = 0)
+    {
+        frames[back].stats = std::move(frame_stats);
+        frames[back].id = id;
+        back = ready.exchange(back | fresh) & ~fresh;
+        signal();
+    }
+
+    // Print each newly presented frame from position 1, 1 of terminal, with its stats below it.
+    // Only the cells that changed since the last frame are sent, all in one write().
+    void output_loop()
     {
-        // This program uses ncurses and multithreading. 
-        // Those 2 don't mix. That's why i use printf to print here.
-        // It is imperative to only use printf because ncurses functions
-        // are being reserved for the user interace.
-        std::unique_lock lock(draw_mutex);
-        printf("\033[%d;%dH", 1, 1);
-        for (int h = 0; h < buffer_height; h++)
+        uint32_t seen = 0;
+        while (true)
         {
-            for(int w = 0; w < buffer_width; w++)
+            signals.wait(seen);
+            seen = signals.load();
+            if (terminate)
+            {
+                return;
+            }
+            const bool new_frame = ready.load() & fresh;
+            if (new_frame)
+            {
+                front = ready.exchange(front) & ~fresh;
+            }
+
+            // This program uses ncurses and multithreading. 
+            // Those 2 don't mix. That's why i write to stdout directly here.
+            // It is imperative to not use ncurses functions here because they
+            // are being reserved for the user interace.
+            std::unique_lock lock(output_mutex);
+            if (invalidated.exchange(false))
+            {
+                encoder.invalidate();
+                stats.clear();
+            }
+            const Frame& frame = frames[front];
+            if (frame.cells.empty())
             {
-                printf("%c",display_buffer[(h*buffer_width)+w]);
+                continue;
+            }
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::string bytes = encoder.encode(frame.cells, frame.width, frame.height);
+            if (frame.stats != stats)
+            {
+                stats = frame.stats;
+                bytes += stats_bytes(frame.height, stats);
+            }
+            else if (!bytes.empty())
+            {
+                bytes += "\033[1;1H";
+            }
+            fflush(stdout);
+            terminal::write_all(STDOUT_FILENO, bytes);
+            if (new_frame && frame.id != 0)
+            {
+                std::lock_guard<std::mutex> lock_guard{written_mutex};
+                written = {frame.id, std::chrono::steady_clock::now() - start, bytes.size()};
             }
-            printf("%c",'\r');
-            printf("%c",'\n');
         }
-        refresh();
     }
 
-    // Print stats to bottom of mandelbrot display area.
-    void print_stats(std::string s)
+    Written last_written()
     {
-        // This program uses ncurses and multithreading. 
-        // Those 2 don't mix. That's why i use printf to print here.
-        // It is imperative to only use printf because ncurses functions
-        // are being reserved for the user interace.
-        stats = s;
+        std::lock_guard<std::mutex> lock_guard{written_mutex};
+        return written;
+    }
 
-        // Erase stats
-        printf("\033[%ld;%dH", buffer_height+1, 1);
-        printf("\x1B[0J"); // Erase from cursor to end of screen.
+    // Escape codes that erase the stats area under a frame of the given height and print s there.
+    static std::string stats_bytes(long int height, const std::string& s)
+    {
+        return std::format("\033[{};1H\x1B[0J\033[{};1H{}\033[1;1H", height + 1, height + 1, s);
+    }
 
-        // Print stats
-        printf("\033[%ld;%dH", buffer_height+1, 1);
-        printf("%s",s.c_str());
-        printf("\033[%d;%dH", 1, 1);
+    // Print stats to bottom of mandelbrot display area, straight away.
+    void print_stats(std::string s)
+    {
+        std::unique_lock lock(output_mutex);
+        stats = s;
+        fflush(stdout);
+        terminal::write_all(STDOUT_FILENO, stats_bytes(buffer_height, s));
     }
 
     // Set how many lines of the display will be dedicated to status info.
@@ -340,36 +893,48 @@ class Display
         set_screen_size();
     }
 
-    // Readjust screensize if necessary.
+    // Readjust screensize if necessary. The renderer picks the new size up at its next frame
+    // and reallocates its back frame then.
     void set_screen_size()
     {
-        // Lock sizes_mutex so it doesnt interfere with draw.
-        std::unique_lock lock(draw_mutex);
         long int window_width = 0;
         long int window_height = 0;
         getmaxyx(stdscr, window_height, window_width);
 
-        if((buffer_width != window_width) | (buffer_height != window_height))
-        {
-            // Set buffer dimensions.
-            buffer_height = window_height - status_lines;
-            buffer_width = window_width - 1;
-            buffer_length = buffer_height * buffer_width;
+        // Set buffer dimensions.
+        buffer_height = std::max(1L, window_height - status_lines);
+        buffer_width = std::max(1L, window_width - 1);
 
-            buffer.resize(buffer_length);
-            std::fill(buffer.begin(), buffer.end(), ' ');
+        // The terminal redraws or clears itself on a resize, so whatever was on screen is unknown.
+        invalidated = true;
+        signal();
+    }
 
-            display_buffer.resize(buffer_length);
-            std::fill(display_buffer.begin(), display_buffer.end(), ' ');
-        }
-        lock.unlock();
+    // Blank the terminal. The next frame is then sent whole.
+    void clear_screen()
+    {
+        std::unique_lock lock(output_mutex);
+        clear();
+        refresh();
+        invalidated = true;
+        signal();
+    }
+
+    void signal()
+    {
+        signals++;
+        signals.notify_one();
     }
 
-    // Put the finished rendered buffer into the display buffer for presentation.
-    void draw()
+    // Stop the output thread. Nothing is written to the terminal after this returns.
+    void stop()
     {
-        // display_buffer.swap(buffer);
-        draw_display_buffer();
+        terminate = true;
+        signal();
+        if (thread.joinable())
+        {
+            thread.join();
+        }
     }
     
     Display()
@@ -383,9 +948,1239 @@ class Display
         // Here to init screen dimensions and set buffer dimmensions.
         set_screen_size();
 
-        // Fill buffers with whatever.
-        std::fill(buffer.begin(), buffer.end(), '|');
-        std::fill(display_buffer.begin(), display_buffer.end(), '|');
+        thread = std::thread(&Display::output_loop, this);
+    }
+
+    ~Display()
+    {
+        stop();
+    }
+};
+
+//
+// Computes frames: picks the arithmetic, keeps the iteration and orbit buffers in step with the view and
+// splits the work among the thread pool. Knows nothing about terminals, the renderer and batch mode both drive it.
+//
+class Engine
+{
+    private:
+    tp::ThreadPool threadPool;
+
+    public:
+    Mandelbrot& mandelbrot;
+
+    // Arithmetic backend forced by the user, Auto lets the pixel spacing decide.
+    std::atomic<precision::Backend> backend = precision::Backend::Auto;
+
+    // Backend used for the last frame and the bits it had to resolve.
+    precision::Backend active_backend = precision::Backend::Double;
+    int required_bits = 0;
+
+    // Vector instruction set of the double precision kernel, picked at runtime.
+    simd::ISA isa = simd::detect();
+    simd::RowKernel row_kernel = simd::kernel_for(isa);
+
+    // Full precision orbit of the view center, reused while the center and iterations stay put.
+    perturbation::ReferenceOrbit reference;
+
+    // Lets every cell skip the iterations shared along the reference orbit.
+    std::atomic<bool> series_approximation = true;
+    perturbation::SeriesApproximation series;
+
+    // Whether the reference and series were brought up to this frame's view yet.
+    bool frame_reference = false;
+
+    // Plans each frame's tiles from the previous frame's per-tile timings.
+    tiles::TileScheduler scheduler;
+
+    // The view being rendered, taken at the start of the frame. The lock is not held while rendering.
+    Mandelbrot::View view;
+
+    // Iteration counts of the last frame, and the cells this frame still has to compute.
+    framebuffer::IterationBuffer iteration_buffer;
+    std::vector<uint8_t> stale;
+    long int stale_cells = 0;
+
+    // Cell strides of a progressive frame, coarse to fine. Each pass computes the stale cells on its grid
+    // that no coarser pass had, and is drawn before the next one starts.
+    static constexpr long int refinement_strides[] = {8, 4, 2, 1};
+
+    // The double kernel refines progressively only once a frame is predicted to take longer than this.
+    static constexpr std::chrono::milliseconds refinement_budget{50};
+
+    // Stale cells of the pass being computed. Cleared as they are computed.
+    std::vector<uint8_t> pass_cells;
+
+    // Whether the last pass is computed by Mariani-Silver subdivision: only the border of a rectangle is iterated,
+    // and when the border and every cell already known inside agree on one escape count, or are all interior,
+    // the rest is filled in. Otherwise the rectangle is halved and each half goes back to the thread pool.
+    std::atomic<bool> subdivision = true;
+
+    // Blocks the subdivision starts from, and the inner area below which a mixed rectangle is simply computed.
+    static constexpr long int subdivision_width = 64;
+    static constexpr long int subdivision_height = 32;
+    static constexpr long int subdivision_min_area = 24;
+
+    // Cells the last frame filled in rather than iterated.
+    std::atomic<long int> frame_filled_cells = 0;
+
+    // Whether cells on an edge, whose escape count differs from a neighbour's, get three more samples at their half-cell
+    // points for the shading to average. Only edges are sampled again, so the cost follows their length, not the area.
+    std::atomic<bool> antialiasing = false;
+    framebuffer::SubsampleBuffer subsamples;
+
+    // Cells the last frame gave subsamples.
+    std::atomic<long int> frame_supersampled_cells = 0;
+
+    // Finished cells of the views seen before, by tile of the lattice they lie on, so zooming back out or returning
+    // somewhere takes them instead of computing them again. Off until given a budget, only the render thread uses it.
+    cache::TileCache tile_cache;
+
+    // Cells the last frame took from the tile cache.
+    long int frame_cached_cells = 0;
+
+    // Tiles kept on disk across sessions, if one was given. Tiles the cache misses are looked up in it, and the ones a frame
+    // computed cells of are appended to it, only for the backends past long double: the others compute faster than they load.
+    store::TileStore* tile_store = nullptr;
+
+    // Whether cells are shaded by their estimated distance to the set rather than their escape count. They are then
+    // iterated with their derivatives, see Mandelbrot::calculate_point_de, and a cell far enough out fills in the
+    // cells after it on its row that its distance bound keeps out of distance_range, instead of them being iterated.
+    // That takes the place of subdivision and anti-aliasing, which go by escape counts.
+    std::atomic<bool> distance_estimation = false;
+
+    // Whether the frame being computed estimates distances. Never for MPFR: past a double's exponent range the
+    // derivatives, kept in doubles, no longer hold the cell size.
+    bool frame_distance = false;
+
+    // Set when a view change arrived while the frame was being computed, the rest of it is abandoned.
+    bool frame_cancelled = false;
+
+    // Where each cell's orbit stopped, in the arithmetic of the backend in use. Only that one is kept.
+    std::tuple<framebuffer::OrbitBuffer<double>, framebuffer::OrbitBuffer<long double>,
+               framebuffer::OrbitBuffer<precision::dd_real>, framebuffer::OrbitBuffer<mpreal>> orbit_buffers;
+
+    // View the iteration counts were computed for. Only the cells a pan or zoom keeps on the same points are reused.
+    mpreal last_real_min;
+    mpreal last_imag_min;
+    mpreal last_width;
+    mpreal last_height;
+    mpreal last_width_scale;
+    mpreal last_height_scale;
+    long int last_first_row = 0;
+    precision::Backend last_backend = precision::Backend::Auto;
+
+    // Set when a setting changes what every cell looks like.
+    std::atomic<bool> full_render = true;
+
+    // How far, in cells, a point may be from one of the last frame's to reuse that cell after a pan or zoom.
+    // The view's edges are only kept a few guard bits finer than a cell, closer than this is the same point.
+    static constexpr double reuse_tolerance = 1e-3;
+
+    // Cells the last frame took over from the one before it across a zoom.
+    long int frame_resampled_cells = 0;
+
+    // Times cells were rebased onto the reference orbit during the last frame.
+    std::atomic<long int> frame_rebases = 0;
+
+    // Iterations the last frame's cells executed, not counting ones they continued from or the series skipped.
+    std::atomic<long int> frame_iterations = 0;
+
+    // Cells of the last frame that escaped, and that did not.
+    long int frame_escaped = 0;
+    long int frame_interior = 0;
+
+    // Cells of the last frame that stopped early as provably interior, by the cardioid and bulb test and by periodicity.
+    long int frame_cardioid_exits = 0;
+    long int frame_periodic_exits = 0;
+
+    // Scales for conversions between a continous point and a discrete buffer index.
+    mpreal width_scale;
+    mpreal height_scale;
+
+    // Size of the grid being rendered, set by each render() call.
+    long int buffer_width = 0;
+    long int buffer_height = 0;
+    long int buffer_length = 0;
+
+    // Rows the whole view is divided into, and the first of them on the grid. A band of a larger image is
+    // projected from the view's top row exactly as in a render of the whole view, so the two match bit for bit.
+    long int view_rows = 0;
+    long int first_row = 0;
+
+    // Called with the stride after each coarse pass of a progressive frame, to draw it. Without one frames are computed in a single pass.
+    std::function<void(long int)> preview;
+
+    Engine(Mandelbrot& mandel_ptr, uint32_t thread_count = num_threads) : threadPool(thread_count), mandelbrot(mandel_ptr)
+    {
+    }
+
+    // Time each worker has spent computing since the engine started.
+    std::vector<std::chrono::nanoseconds> busy_times() const
+    {
+        return threadPool.busy_times();
+    }
+
+    // Keep what the orbit found out about a cell. Shading happens in its own pass.
+    void store(long int buff_pos, int iter, double norm, framebuffer::Outcome outcome)
+    {
+        const bool escaped = outcome == framebuffer::Outcome::Escaped;
+        iteration_buffer[buff_pos] = {iter, framebuffer::smooth_iterations(iter, escaped, norm), outcome};
+    }
+
+    // Resume state buffer for the arithmetic Real, sized to the grid.
+    template<typename Real>
+    framebuffer::OrbitBuffer<Real>& orbits()
+    {
+        framebuffer::OrbitBuffer<Real>& buffer = std::get<framebuffer::OrbitBuffer<Real>>(orbit_buffers);
+        if (!buffer.matches(buffer_width, buffer_height))
+        {
+            buffer.resize(buffer_width, buffer_height);
+        }
+        return buffer;
+    }
+
+    // From a run of one buffer row calculate the corresponding points on the mandelbrot.
+    template<typename Real>
+    void raster_row(const precision::Viewport<Real>& viewport, framebuffer::OrbitBuffer<Real>& states, long int buff_y, long int x0, long int x1)
+    {
+        // Project buffer row onto mandelbrot.
+        const Real y = viewport.imag_at(first_row + buff_y);
+        long int executed = 0;
+        for(long int buff_x = x0; buff_x < x1; buff_x++)
+        {
+            Real x = viewport.real_at(buff_x);
+            const long int buff_pos = buff_y * buffer_width + buff_x;
+            const int start = iteration_buffer[buff_pos].iterations;
+
+            // Get iteration and place it into the iteration buffer.
+            double norm = 0.0;
+            framebuffer::Outcome outcome;
+            int iter = mandelbrot.calculate_point( x, y, states[buff_pos], start, view.max_iterations, norm, outcome );
+            executed += iter - start;
+            store( buff_pos, iter, norm, outcome );
+        }
+        frame_iterations += executed;
+    }
+
+    // Keep a distance estimated cell, then fill in the cells after it on the row, up to `run` cells in all, that its bound
+    // keeps further than distance_range from the set: they shade blank whatever they would have come to. Returns how
+    // many cells that was. None of them keeps an orbit, a Bounded one starts over when the limit is raised.
+    long int store_distance(long int buff_pos, long int run, int iter, double norm, double distance, framebuffer::Outcome outcome)
+    {
+        store(buff_pos, iter, norm, outcome);
+        framebuffer::Sample& sample = iteration_buffer[buff_pos];
+        sample.distance = static_cast<float>(std::min(distance, 1e30));
+        sample.no_orbit = true;
+
+        const long int reach = static_cast<long int>(std::clamp(std::floor(distance - framebuffer::distance_range), 0.0, static_cast<double>(run - 1)));
+        for (long int i = 1; i <= reach; i++)
+        {
+            iteration_buffer[buff_pos + i] = sample;
+            iteration_buffer[buff_pos + i].distance = static_cast<float>(sample.distance - i);
+        }
+        frame_filled_cells += reach;
+        return reach + 1;
+    }
+
+    // raster_row with distance estimation.
+    template<typename Real>
+    void raster_row_de(const precision::Viewport<Real>& viewport, long int buff_y, long int x0, long int x1)
+    {
+        const Real y = viewport.imag_at(first_row + buff_y);
+        const double cell = precision::to_double(viewport.width_scale);
+        long int executed = 0;
+        for(long int buff_x = x0; buff_x < x1; )
+        {
+            double norm = 0.0;
+            double distance = 0.0;
+            framebuffer::Outcome outcome;
+            const int iter = mandelbrot.calculate_point_de( viewport.real_at(buff_x), y, cell, view.max_iterations, norm, distance, outcome );
+            executed += iter;
+            buff_x += store_distance(buff_y * buffer_width + buff_x, x1 - buff_x, iter, norm, distance, outcome);
+        }
+        frame_iterations += executed;
+    }
+
+    // MPFR raster_row. Projection and orbit run on the worker's registers, nothing is allocated per cell or iteration.
+    void raster_row_mpfr(const precision::Viewport<mpreal>& viewport, framebuffer::OrbitBuffer<mpreal>& states, long int buff_y, long int x0, long int x1)
+    {
+        mpfr_kernel::Scratch& registers = mpfr_kernel::scratch();
+        registers.set_precision(std::max({viewport.real_min.get_prec(), viewport.imag_min.get_prec(),
+                                          viewport.width_scale.get_prec(), viewport.height_scale.get_prec()}));
+        registers.project(registers.imagc, viewport.imag_min, viewport.height_scale, first_row + buff_y);
+
+        long int executed = 0;
+        for(long int buff_x = x0; buff_x < x1; buff_x++)
+        {
+            const long int buff_pos = buff_y * buffer_width + buff_x;
+            framebuffer::OrbitState<mpreal>& state = states[buff_pos];
+            const int start = iteration_buffer[buff_pos].iterations;
+            int iter = start;
+
+            registers.project(registers.realc, viewport.real_min, viewport.width_scale, buff_x);
+            if (iter == 0)
+            {
+                mpfr_set_si(registers.zx, 0, MPFR_RNDN);
+                mpfr_set_si(registers.zy, 0, MPFR_RNDN);
+            }
+            else
+            {
+                mpfr_set(registers.zx, state.zx.mpfr_srcptr(), MPFR_RNDN);
+                mpfr_set(registers.zy, state.zy.mpfr_srcptr(), MPFR_RNDN);
+            }
+
+            double norm = 0.0;
+            framebuffer::Outcome outcome;
+            iter = mandelbrot.calculate_point_mpfr(registers, iter, view.max_iterations, norm, outcome);
+            if (outcome == framebuffer::Outcome::Bounded)
+            {
+                mpfr_kernel::save(state.zx, registers.zx);
+                mpfr_kernel::save(state.zy, registers.zy);
+            }
+            executed += iter - start;
+            store( buff_pos, iter, norm, outcome );
+        }
+        frame_iterations += executed;
+    }
+
+    // Double precision raster_row. Each stretch of the run whose cells stopped at the same iteration is one vector batch.
+    void raster_row_simd(const precision::Viewport<double>& viewport, framebuffer::OrbitBuffer<double>& states, long int buff_y, long int x0, long int x1)
+    {
+        thread_local std::vector<double> realc;
+        thread_local std::vector<int> iterations;
+        thread_local std::vector<double> zx;
+        thread_local std::vector<double> zy;
+        thread_local std::vector<double> norms;
+        thread_local std::vector<framebuffer::Outcome> outcomes;
+        const long int count = x1 - x0;
+        const long int row_pos = buff_y * buffer_width + x0;
+        realc.resize(count);
+        iterations.resize(count);
+        zx.resize(count);
+        zy.resize(count);
+        norms.resize(count);
+        outcomes.resize(count);
+
+        for (long int i = 0; i < count; i++)
+        {
+            realc[i] = viewport.real_at(x0 + i);
+            zx[i] = states[row_pos + i].zx;
+            zy[i] = states[row_pos + i].zy;
+        }
+        for (long int i = 0; i < count; )
+        {
+            const int start = iteration_buffer[row_pos + i].iterations;
+            long int end = i + 1;
+            while (end < count && iteration_buffer[row_pos + end].iterations == start) { end++; }
+            // A lone cell, such as one of a column subdivision computes, would run a whole vector for one lane.
+            const simd::RowKernel kernel = end - i == 1 ? simd::escape_row_scalar : row_kernel;
+            mandelbrot.calculate_row(kernel, realc.data() + i, viewport.imag_at(first_row + buff_y), end - i, start, view.max_iterations,
+                                     iterations.data() + i, zx.data() + i, zy.data() + i, norms.data() + i, outcomes.data() + i);
+            i = end;
+        }
+
+        long int executed = 0;
+        for (long int i = 0; i < count; i++)
+        {
+            states[row_pos + i].zx = zx[i];
+            states[row_pos + i].zy = zy[i];
+            executed += iterations[i] - iteration_buffer[row_pos + i].iterations;
+            store( row_pos + i, iterations[i], norms[i], outcomes[i] );
+        }
+        frame_iterations += executed;
+    }
+
+    // Same as raster_row, but each cell is iterated as a double delta from the reference orbit.
+    void raster_row_perturbed(const precision::Viewport<double>& deltas, framebuffer::OrbitBuffer<double>& states, long int buff_y, long int x0, long int x1)
+    {
+        long int rebases = 0;
+        long int executed = 0;
+        const double dci = deltas.imag_at(first_row + buff_y);
+        for(long int buff_x = x0; buff_x < x1; buff_x++)
+        {
+            const long int buff_pos = buff_y * buffer_width + buff_x;
+            const int start = iteration_buffer[buff_pos].iterations;
+            double norm = 0.0;
+            framebuffer::Outcome outcome;
+            int iter = mandelbrot.calculate_perturbed( reference, series, deltas.real_at(buff_x), dci, states[buff_pos], start, view.max_iterations, norm, outcome, rebases );
+            executed += iter - (start == 0 ? series.skip : start);
+            store( buff_pos, iter, norm, outcome );
+        }
+        frame_rebases += rebases;
+        frame_iterations += executed;
+    }
+
+    // raster_row_perturbed with distance estimation.
+    void raster_row_perturbed_de(const precision::Viewport<double>& deltas, long int buff_y, long int x0, long int x1)
+    {
+        long int rebases = 0;
+        long int executed = 0;
+        const double dci = deltas.imag_at(first_row + buff_y);
+        for(long int buff_x = x0; buff_x < x1; )
+        {
+            double norm = 0.0;
+            double distance = 0.0;
+            framebuffer::Outcome outcome;
+            const int iter = mandelbrot.calculate_perturbed_de( reference, deltas.real_at(buff_x), dci, deltas.width_scale, view.max_iterations, norm, distance, outcome, rebases );
+            executed += iter;
+            buff_x += store_distance(buff_y * buffer_width + buff_x, x1 - buff_x, iter, norm, distance, outcome);
+        }
+        frame_rebases += rebases;
+        frame_iterations += executed;
+    }
+
+    // Old cell index of each new column or row: cell i of the new grid is at offset + ratio * i old cells,
+    // and keeps the old cell it lands on exactly. -1 where it lands between cells or off the grid.
+    static std::vector<long int> line_up(double offset, double ratio, long int count)
+    {
+        std::vector<long int> map(count, -1);
+        for (long int i = 0; i < count; i++)
+        {
+            const double position = offset + ratio * i;
+            const long int cell = std::lround(position);
+            if (std::abs(position - cell) < reuse_tolerance && cell >= 0 && cell < count)
+            {
+                map[i] = cell;
+            }
+        }
+        return map;
+    }
+
+    // After a zoom the cells whose point was also computed last frame take over its sample and orbit. Around
+    // the zoom center that is one column and one row in q for a zoom factor of p/q, every other one at 1/2.
+    // Returns false when no cell lines up.
+    bool resample()
+    {
+        const double ratio_x = (width_scale / last_width_scale).toDouble();
+        const double ratio_y = (height_scale / last_height_scale).toDouble();
+        const double offset_x = ((view.real_min - last_real_min) / last_width_scale).toDouble();
+        const double offset_y = ((view.imag_min - last_imag_min) / last_height_scale).toDouble() + ratio_y * first_row - last_first_row;
+
+        const std::vector<long int> columns = line_up(offset_x, ratio_x, buffer_width);
+        const std::vector<long int> rows = line_up(offset_y, ratio_y, buffer_height);
+        const long int kept_columns = std::count_if(columns.begin(), columns.end(), [](long int cell){ return cell >= 0; });
+        const long int kept_rows = std::count_if(rows.begin(), rows.end(), [](long int cell){ return cell >= 0; });
+        if (kept_columns == 0 || kept_rows == 0)
+        {
+            return false;
+        }
+
+        iteration_buffer.remap(columns, rows);
+        subsamples.remap(columns, rows);
+        std::apply([&columns, &rows](auto&... buffers){ (buffers.remap(columns, rows), ...); }, orbit_buffers);
+        frame_resampled_cells = kept_columns * kept_rows;
+        return true;
+    }
+
+    // Key of the cached tile tile_x, tile_y tiles from the lattice origin, for this view.
+    cache::TileKey tile_key(long int tile_x, long int tile_y) const
+    {
+        return {view.lattice, view.zoom_level, buffer_width, view_rows, view.max_iterations, static_cast<int>(active_backend), tile_x, tile_y};
+    }
+
+    static long int floor_div(long int a, long int b)
+    {
+        return a / b - (a % b < 0);
+    }
+
+    // Call back with each cached tile the grid overlaps, the rectangle of the grid it covers, and where its
+    // top left cell is on the grid, outside it for a tile cut by the grid's edge.
+    template<typename Tile_Function>
+    void for_each_tile(Tile_Function&& callback) const
+    {
+        const long int left = view.lattice_x;
+        const long int top = view.lattice_y + first_row;
+        for (long int tile_y = floor_div(top, cache::tile_height); tile_y * cache::tile_height < top + buffer_height; tile_y++)
+        {
+            for (long int tile_x = floor_div(left, cache::tile_width); tile_x * cache::tile_width < left + buffer_width; tile_x++)
+            {
+                const long int origin_x = tile_x * cache::tile_width - left;
+                const long int origin_y = tile_y * cache::tile_height - top;
+                const tiles::Tile rect{std::max(0L, origin_x), std::max(0L, origin_y),
+                                       std::min(buffer_width, origin_x + cache::tile_width), std::min(buffer_height, origin_y + cache::tile_height)};
+                callback(tile_key(tile_x, tile_y), rect, origin_x, origin_y);
+            }
+        }
+    }
+
+    bool uses_tile_store() const
+    {
+        return tile_store != nullptr && (active_backend == precision::Backend::DoubleDouble || active_backend == precision::Backend::Perturbation
+                                         || active_backend == precision::Backend::MPFR);
+    }
+
+    // Key of the stored tile whose top left cell is at origin_x, origin_y on the grid.
+    store::StoreKey store_key(long int origin_x, long int origin_y) const
+    {
+        return store::key_for(view.real_min + width_scale * origin_x, view.imag_min + height_scale * (first_row + origin_y), width_scale, height_scale,
+                              view.max_iterations, static_cast<int>(active_backend), frame_distance);
+    }
+
+    // Take the stale cells the tile cache has for this view, loading the tiles it misses from the tile store.
+    // Like filled cells they have no orbit to continue.
+    void restore_tiles()
+    {
+        const bool stored = uses_tile_store();
+        if (stored)
+        {
+            tile_store->refresh();
+        }
+        for_each_tile([this, stored](const cache::TileKey& key, const tiles::Tile& rect, long int origin_x, long int origin_y){
+            const cache::Tile* tile = tile_cache.find(key);
+            if (tile == nullptr && stored)
+            {
+                cache::Tile loaded;
+                if (tile_store->find(store_key(origin_x, origin_y), loaded))
+                {
+                    cache::Tile& cached = tile_cache.store(key);
+                    cached = std::move(loaded);
+                    tile = &cached;
+                }
+            }
+            if (tile == nullptr)
+            {
+                return;
+            }
+            for (long int y = rect.y0; y < rect.y1; y++)
+            {
+                for (long int x = rect.x0; x < rect.x1; x++)
+                {
+                    const long int buff_pos = y * buffer_width + x;
+                    const long int cell = (y - origin_y) * cache::tile_width + x - origin_x;
+                    if (!stale[buff_pos] || !tile->known[cell])
+                    {
+                        continue;
+                    }
+                    iteration_buffer[buff_pos] = tile->samples[cell];
+                    iteration_buffer[buff_pos].no_orbit = true;
+                    subsamples[buff_pos] = tile->subsamples[cell];
+                    stale[buff_pos] = 0;
+                    frame_cached_cells++;
+                }
+            }
+        });
+    }
+
+    // Keep a finished frame's cells in the tile cache, and the tiles it computed cells of in the tile store.
+    void store_tiles()
+    {
+        const bool stored = uses_tile_store();
+        for_each_tile([this, stored](const cache::TileKey& key, const tiles::Tile& rect, long int origin_x, long int origin_y){
+            cache::Tile& tile = tile_cache.store(key);
+            bool computed = false;
+            for (long int y = rect.y0; y < rect.y1; y++)
+            {
+                const long int buff_pos = y * buffer_width + rect.x0;
+                const long int cell = (y - origin_y) * cache::tile_width + rect.x0 - origin_x;
+                std::copy_n(iteration_buffer.cells.begin() + buff_pos, rect.width(), tile.samples.begin() + cell);
+                std::copy_n(subsamples.cells.begin() + buff_pos, rect.width(), tile.subsamples.begin() + cell);
+                std::fill_n(tile.known.begin() + cell, rect.width(), 1);
+                computed = computed || std::any_of(stale.begin() + buff_pos, stale.begin() + buff_pos + rect.width(), [](uint8_t cell){ return cell != 0; });
+            }
+            if (stored && computed)
+            {
+                tile_store->append(store_key(origin_x, origin_y), tile);
+            }
+        });
+    }
+
+    // If this frame is the previous one moved by whole cells, shift the kept samples and orbits along, and if it
+    // is zoomed, keep the cells that stayed on the same points. Otherwise every cell starts over. Stale are the
+    // cells whose orbit is still bounded and short of the iteration limit: newly exposed or reset ones, and after
+    // a raised limit the ones that had not escaped.
+    // A view that did not move and a lowered limit leave nothing to compute, only the shading runs again.
+    // Stale cells the tile cache has are taken from it.
+    void prepare_frame()
+    {
+        const long int length = buffer_length;
+        const bool forced = full_render.exchange(false);
+        bool reused = false;
+        frame_resampled_cells = 0;
+        frame_cached_cells = 0;
+        if (forced)
+        {
+            tile_cache.clear();
+        }
+
+        const bool comparable = !forced && iteration_buffer.matches(buffer_width, buffer_height) && last_backend == active_backend;
+        if (comparable && (last_width != view.width || last_height != view.height))
+        {
+            reused = resample();
+        }
+        else if (comparable)
+        {
+            const double dx = ((view.real_min - last_real_min) / width_scale).toDouble();
+            const double dy = ((view.imag_min - last_imag_min) / height_scale).toDouble() + (first_row - last_first_row);
+            const long int cells_x = std::lround(dx);
+            const long int cells_y = std::lround(dy);
+
+            if (std::abs(dx - cells_x) < reuse_tolerance && std::abs(dy - cells_y) < reuse_tolerance
+                && std::abs(cells_x) < buffer_width && std::abs(cells_y) < buffer_height)
+            {
+                if (cells_x != 0 || cells_y != 0)
+                {
+                    iteration_buffer.shift(cells_x, cells_y);
+                    subsamples.shift(cells_x, cells_y);
+                    std::apply([cells_x, cells_y](auto&... buffers){ (buffers.shift(cells_x, cells_y), ...); }, orbit_buffers);
+                    scheduler.shift(cells_x, cells_y);
+                }
+                reused = true;
+            }
+        }
+
+        if (!reused || !subsamples.matches(buffer_width, buffer_height))
+        {
+            subsamples.resize(buffer_width, buffer_height);
+        }
+        if (!reused)
+        {
+            iteration_buffer.resize(buffer_width, buffer_height);
+            std::apply([](auto&... buffers){ (buffers.clear(), ...); }, orbit_buffers);
+        }
+
+        stale.resize(length);
+        for (long int buff_pos = 0; buff_pos < length; buff_pos++)
+        {
+            framebuffer::Sample& sample = iteration_buffer[buff_pos];
+            stale[buff_pos] = sample.outcome == framebuffer::Outcome::Bounded && sample.iterations < view.max_iterations;
+            if (stale[buff_pos] && sample.no_orbit)
+            {
+                sample = {};
+                std::apply([this, buff_pos](auto&... buffers){ ((buffers.matches(buffer_width, buffer_height) ? void(buffers[buff_pos] = {}) : void()), ...); }, orbit_buffers);
+            }
+
+            // Subsamples of a cell computed again, or cut short by a lower limit than this one, are sampled again.
+            framebuffer::Subsamples& extra = subsamples[buff_pos];
+            for (int i = 0; i < 3 && extra.valid; i++)
+            {
+                extra.valid = !stale[buff_pos] && !(extra.outcomes[i] == framebuffer::Outcome::Bounded && extra.iterations[i] < view.max_iterations);
+            }
+        }
+        if (tile_cache.enabled())
+        {
+            restore_tiles();
+        }
+        stale_cells = std::count(stale.begin(), stale.end(), 1);
+
+        last_real_min = view.real_min;
+        last_imag_min = view.imag_min;
+        last_width = view.width;
+        last_height = view.height;
+        last_width_scale = width_scale;
+        last_height_scale = height_scale;
+        last_first_row = first_row;
+        last_backend = active_backend;
+    }
+
+    // Tally how the cells computed this frame ended early, and how all of them ended, for the debug stats.
+    void count_exits()
+    {
+        frame_cardioid_exits = 0;
+        frame_periodic_exits = 0;
+        frame_escaped = 0;
+        for (long int buff_pos = 0; buff_pos < buffer_length; buff_pos++)
+        {
+            const framebuffer::Sample& sample = iteration_buffer[buff_pos];
+            frame_escaped += sample.outcome == framebuffer::Outcome::Escaped && sample.iterations < view.max_iterations;
+            if (!stale[buff_pos]) { continue; }
+            frame_cardioid_exits += sample.outcome == framebuffer::Outcome::Cardioid;
+            frame_periodic_exits += sample.outcome == framebuffer::Outcome::Periodic;
+        }
+        frame_interior = buffer_length - frame_escaped;
+    }
+
+    // Whether to draw this frame coarse first, only when there is a preview to draw. The other backends iterate one
+    // cell at a time and always refine. The double kernel would have its vector runs cut into single cells, so it only refines when slow.
+    bool refine_progressively() const
+    {
+        if (!preview)
+        {
+            return false;
+        }
+        return active_backend != precision::Backend::Double
+            || scheduler.predict(stale, threadPool.thread_count) > refinement_budget;
+    }
+
+    // Mark the stale cells on the stride grid that are not on the grid of the previous, coarser, pass.
+    void mark_pass(long int stride, long int coarser)
+    {
+        pass_cells.resize(buffer_length);
+        for (long int buff_pos = 0; buff_pos < buffer_length; buff_pos++)
+        {
+            const long int x = buff_pos % buffer_width;
+            const long int y = buff_pos / buffer_width;
+            const bool on_grid = x % stride == 0 && y % stride == 0;
+            const bool done = coarser > 0 && x % coarser == 0 && y % coarser == 0;
+            pass_cells[buff_pos] = stale[buff_pos] && on_grid && !done;
+        }
+    }
+
+    // Compute the pass's cells in a rectangle, each row in runs of consecutive ones. Returns how many there were.
+    template<typename Row_Function>
+    long int raster_runs(Row_Function& raster, const tiles::Tile& rect)
+    {
+        long int computed = 0;
+        for (long int y = rect.y0; y < rect.y1; y++)
+        {
+            uint8_t* row = pass_cells.data() + y * buffer_width;
+            for (long int x = rect.x0; x < rect.x1; )
+            {
+                if (!row[x])
+                {
+                    x++;
+                    continue;
+                }
+                long int run_end = x;
+                while (run_end < rect.x1 && row[run_end]) { run_end++; }
+                raster(y, x, run_end);
+                std::fill(row + x, row + run_end, 0);
+                computed += run_end - x;
+                x = run_end;
+            }
+        }
+        return computed;
+    }
+
+    // What subdivision compares cells by: the escape count, or -1 for every cell that did not escape.
+    long int escape_class(const framebuffer::Sample& sample) const
+    {
+        return sample.outcome == framebuffer::Outcome::Escaped && sample.iterations < view.max_iterations ? sample.iterations : -1;
+    }
+
+    // Final pass by subdivision. Each block's border is computed, then the block is subdivided. Blocks are
+    // timed as a whole, over every task working on them, for the next frame's plan. Returns false if cancelled.
+    template<typename Row_Function>
+    bool subdivide_pass(Row_Function& raster)
+    {
+        std::vector<tiles::Tile> blocks;
+        for (long int y = 0; y < buffer_height; y += subdivision_height)
+        {
+            for (long int x = 0; x < buffer_width; x += subdivision_width)
+            {
+                blocks.push_back({x, y, std::min(x + subdivision_width, buffer_width), std::min(y + subdivision_height, buffer_height)});
+            }
+        }
+        std::vector<std::atomic<int64_t>> elapsed(blocks.size());
+        std::atomic<bool> cancelled = false;
+
+        tp::Latch latch;
+        for (size_t index = 0; index < blocks.size(); index++)
+        {
+            threadPool.submit(latch, [this, &raster, &blocks, &elapsed, &cancelled, &latch, index](){
+                const tiles::Tile& block = blocks[index];
+                const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                raster_runs(raster, {block.x0, block.y0, block.x1, block.y0 + 1});
+                raster_runs(raster, {block.x0, block.y1 - 1, block.x1, block.y1});
+                raster_runs(raster, {block.x0, block.y0 + 1, block.x0 + 1, block.y1 - 1});
+                raster_runs(raster, {block.x1 - 1, block.y0 + 1, block.x1, block.y1 - 1});
+                elapsed[index] += (std::chrono::steady_clock::now() - start).count();
+                subdivide(raster, block, elapsed[index], cancelled, latch);
+            });
+        }
+        latch.wait();
+        if (cancelled)
+        {
+            return false;
+        }
+
+        for (size_t index = 0; index < blocks.size(); index++)
+        {
+            scheduler.record(blocks[index], std::chrono::nanoseconds{elapsed[index].load()});
+        }
+        return true;
+    }
+
+    // Fill or split a rectangle whose border is known. A split computes the line between the halves first,
+    // so that both halves' borders are known and the halves, sharing only that line, can run in parallel.
+    template<typename Row_Function>
+    void subdivide(Row_Function& raster, const tiles::Tile& rect, std::atomic<int64_t>& elapsed, std::atomic<bool>& cancelled, tp::Latch& latch)
+    {
+        if (cancelled || mandelbrot.outdated(view))
+        {
+            cancelled = true;
+            return;
+        }
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        const tiles::Tile inner{rect.x0 + 1, rect.y0 + 1, rect.x1 - 1, rect.y1 - 1};
+        if (inner.width() <= 0 || inner.height() <= 0)
+        {
+            return;
+        }
+
+        // Every cell not left to compute in this pass is known, on the border or not.
+        const framebuffer::Sample& corner = iteration_buffer[rect.y0 * buffer_width + rect.x0];
+        const long int kind = escape_class(corner);
+        bool uniform = true;
+        long int unknown = 0;
+        for (long int y = rect.y0; y < rect.y1 && uniform; y++)
+        {
+            for (long int x = rect.x0; x < rect.x1; x++)
+            {
+                const long int buff_pos = y * buffer_width + x;
+                if (pass_cells[buff_pos])
+                {
+                    unknown++;
+                }
+                else if (escape_class(iteration_buffer[buff_pos]) != kind)
+                {
+                    uniform = false;
+                    break;
+                }
+            }
+        }
+
+        if (uniform)
+        {
+            const framebuffer::Sample fill = kind >= 0
+                ? framebuffer::Sample{corner.iterations, corner.smooth, framebuffer::Outcome::Escaped, true}
+                : framebuffer::Sample{static_cast<int32_t>(view.max_iterations), static_cast<float>(view.max_iterations), framebuffer::Outcome::Bounded, true};
+            for (long int y = inner.y0; y < inner.y1; y++)
+            {
+                for (long int x = inner.x0; x < inner.x1; x++)
+                {
+                    const long int buff_pos = y * buffer_width + x;
+                    if (pass_cells[buff_pos])
+                    {
+                        iteration_buffer[buff_pos] = fill;
+                        pass_cells[buff_pos] = 0;
+                    }
+                }
+            }
+            frame_filled_cells += unknown;
+        }
+        else if (inner.area() <= subdivision_min_area)
+        {
+            raster_runs(raster, inner);
+        }
+        else
+        {
+            // Halve along the longer side, measured in pixels of roughly 2:1 terminal cells. The vector kernel only
+            // ever splits across rows: it would compute a column one lane at a time, costing more than the fill saves.
+            const bool rows_only = active_backend == precision::Backend::Double && row_kernel != simd::escape_row_scalar;
+            tiles::Tile first = rect;
+            tiles::Tile second = rect;
+            if (!rows_only && rect.width() >= rect.height() * 2)
+            {
+                const long int mid = rect.x0 + rect.width() / 2;
+                raster_runs(raster, {mid, inner.y0, mid + 1, inner.y1});
+                first.x1 = mid + 1;
+                second.x0 = mid;
+            }
+            else
+            {
+                const long int mid = rect.y0 + rect.height() / 2;
+                raster_runs(raster, {inner.x0, mid, inner.x1, mid + 1});
+                first.y1 = mid + 1;
+                second.y0 = mid;
+            }
+            threadPool.submit(latch, [this, &raster, first, &elapsed, &cancelled, &latch](){ subdivide(raster, first, elapsed, cancelled, latch); });
+            threadPool.submit(latch, [this, &raster, second, &elapsed, &cancelled, &latch](){ subdivide(raster, second, elapsed, cancelled, latch); });
+        }
+        elapsed += (std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Hand the planned tiles to the workers, most expensive first, once per refinement pass. Only the runs of
+    // each tile row in the pass are computed, and tiles that were wholly stale are timed for the next frame's plan.
+    // A view change makes the workers skip their remaining tiles, the frame is then left unfinished.
+    template<typename Row_Function>
+    void render_tiles(Row_Function&& raster)
+    {
+        const std::vector<tiles::Tile> plan = scheduler.plan(buffer_width, buffer_height, threadPool.thread_count);
+        std::vector<std::chrono::steady_clock::duration> elapsed(plan.size());
+        std::vector<long int> computed(plan.size());
+        std::atomic<bool> cancelled = false;
+
+        std::span<const long int> strides{refinement_strides};
+        if (!refine_progressively())
+        {
+            strides = strides.last(1);
+        }
+        long int coarser = 0;
+        for (long int stride : strides)
+        {
+            mark_pass(stride, coarser);
+            coarser = stride;
+
+            if (stride == 1 && subdivision && !frame_distance)
+            {
+                if (!subdivide_pass(raster))
+                {
+                    frame_cancelled = true;
+                    return;
+                }
+                break;
+            }
+            threadPool.run_each(plan, [this, &raster, &plan, &elapsed, &computed, &cancelled](const tiles::Tile& tile){
+                if (cancelled || mandelbrot.outdated(view))
+                {
+                    cancelled = true;
+                    return;
+                }
+                const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                const size_t index = &tile - plan.data();
+                computed[index] += raster_runs(raster, tile);
+                elapsed[index] += std::chrono::steady_clock::now() - start;
+            });
+
+            if (cancelled)
+            {
+                frame_cancelled = true;
+                return;
+            }
+            if (stride > 1)
+            {
+                preview(stride);
+            }
+        }
+
+        for (size_t index = 0; index < plan.size(); index++)
+        {
+            if (computed[index] == plan[index].area())
+            {
+                scheduler.record(plan[index], elapsed[index]);
+            }
+        }
+        scheduler.frame_done();
+    }
+
+    // The double path runs each tile row through the widest vector kernel the CPU supports. Distance estimation
+    // has no vector kernel and goes through the scalar one.
+    void render_rows()
+    {
+        if (frame_distance)
+        {
+            render_frame<double>();
+            return;
+        }
+        const precision::Viewport<double> viewport{view.real_min, view.imag_min, width_scale, height_scale};
+        framebuffer::OrbitBuffer<double>& states = orbits<double>();
+        render_tiles([this, &viewport, &states](long int y, long int x0, long int x1){ raster_row_simd(viewport, states, y, x0, x1); });
+    }
+
+    // Iterate the view center once at full precision, then every cell only as an offset from it.
+    void render_perturbed()
+    {
+        // Offsets of the top left cell from the reference, small enough to be exact in a double.
+        const precision::Viewport<double> deltas{
+            view.real_min - view.real_coordinate, view.imag_min - view.imag_coordinate,
+            width_scale, height_scale};
+        update_reference(deltas);
+
+        if (frame_distance)
+        {
+            render_tiles([this, &deltas](long int y, long int x0, long int x1){ raster_row_perturbed_de(deltas, y, x0, x1); });
+            return;
+        }
+        framebuffer::OrbitBuffer<double>& states = orbits<double>();
+        render_tiles([this, &deltas, &states](long int y, long int x0, long int x1){ raster_row_perturbed(deltas, states, y, x0, x1); });
+    }
+
+    // Bring the reference orbit to the view center and iteration limit, and fit the series approximation to the view,
+    // once per frame. A raised iteration limit extends the stored reference rather than recomputing it.
+    void update_reference(const precision::Viewport<double>& deltas)
+    {
+        if (frame_reference)
+        {
+            return;
+        }
+        frame_reference = true;
+
+        if (!reference.matches(view.real_coordinate, view.imag_coordinate))
+        {
+            reference.compute(view.real_coordinate, view.imag_coordinate, view.max_iterations);
+        }
+        else
+        {
+            reference.extend(view.max_iterations);
+        }
+
+        // Largest offset from the reference in the view bounds the series approximation's error. Taken over
+        // the whole view rather than the rows on the grid, so every band of it skips the same iterations.
+        const double far_real = std::max(std::abs(deltas.real_min), std::abs(deltas.real_at(buffer_width)));
+        const double far_imag = std::max(std::abs(deltas.imag_min), std::abs(deltas.imag_at(view_rows)));
+        if (series_approximation && !frame_distance)
+        {
+            series.compute(reference, std::hypot(far_real, far_imag), std::min(deltas.width_scale, deltas.height_scale), view.max_iterations);
+        }
+        else
+        {
+            series = perturbation::SeriesApproximation{};
+        }
+    }
+
+    // Convert the projection into the backend's arithmetic once, then split the buffer among the workers.
+    template<typename Real>
+    void render_frame()
+    {
+        const precision::Viewport<Real> viewport{view.real_min, view.imag_min, width_scale, height_scale};
+        framebuffer::OrbitBuffer<Real>& states = orbits<Real>();
+        if constexpr (std::is_same_v<Real, mpreal>)
+        {
+            render_tiles([this, &viewport, &states](long int y, long int x0, long int x1){ raster_row_mpfr(viewport, states, y, x0, x1); });
+        }
+        else if (frame_distance)
+        {
+            render_tiles([this, &viewport](long int y, long int x0, long int x1){ raster_row_de(viewport, y, x0, x1); });
+        }
+        else
+        {
+            render_tiles([this, &viewport, &states](long int y, long int x0, long int x1){ raster_row(viewport, states, y, x0, x1); });
+        }
+    }
+
+    // Whether a cell's escape count differs from one of its neighbours' on the grid.
+    bool on_edge(long int x, long int y) const
+    {
+        const long int kind = escape_class(iteration_buffer[y * buffer_width + x]);
+        return (x > 0 && escape_class(iteration_buffer[y * buffer_width + x - 1]) != kind)
+            || (x + 1 < buffer_width && escape_class(iteration_buffer[y * buffer_width + x + 1]) != kind)
+            || (y > 0 && escape_class(iteration_buffer[(y - 1) * buffer_width + x]) != kind)
+            || (y + 1 < buffer_height && escape_class(iteration_buffer[(y + 1) * buffer_width + x]) != kind);
+    }
+
+    // Sample points fx[i], fy of the half-cell grid `fine`, on which cell x, y is point 2x, 2y, into samples[i].
+    // Nothing of their orbits is kept.
+    template<typename Real>
+    void probe_row(const precision::Viewport<Real>& fine, const std::vector<long int>& fx, long int fy, framebuffer::Sample* samples, long int& executed)
+    {
+        const Real imag = fine.imag_at(fy);
+        for (size_t i = 0; i < fx.size(); i++)
+        {
+            framebuffer::OrbitState<Real> orbit;
+            double norm = 0.0;
+            framebuffer::Outcome outcome;
+            const int iter = mandelbrot.calculate_point(fine.real_at(fx[i]), imag, orbit, 0, view.max_iterations, norm, outcome);
+            executed += iter;
+            samples[i] = {iter, framebuffer::smooth_iterations(iter, outcome == framebuffer::Outcome::Escaped, norm), outcome};
+        }
+    }
+
+    // The points of a row share their imaginary part, so the double backend runs them through the vector kernel together.
+    void probe_row_simd(const precision::Viewport<double>& fine, const std::vector<long int>& fx, long int fy, framebuffer::Sample* samples, long int& executed)
+    {
+        thread_local std::vector<double> realc;
+        thread_local std::vector<int> iterations;
+        thread_local std::vector<double> zx;
+        thread_local std::vector<double> zy;
+        thread_local std::vector<double> norms;
+        thread_local std::vector<framebuffer::Outcome> outcomes;
+        const long int count = fx.size();
+        realc.resize(count);
+        iterations.resize(count);
+        zx.assign(count, 0.0);
+        zy.assign(count, 0.0);
+        norms.resize(count);
+        outcomes.resize(count);
+
+        for (long int i = 0; i < count; i++)
+        {
+            realc[i] = fine.real_at(fx[i]);
+        }
+        mandelbrot.calculate_row(row_kernel, realc.data(), fine.imag_at(fy), count, 0, view.max_iterations,
+                                 iterations.data(), zx.data(), zy.data(), norms.data(), outcomes.data());
+        for (long int i = 0; i < count; i++)
+        {
+            executed += iterations[i];
+            samples[i] = {iterations[i], framebuffer::smooth_iterations(iterations[i], outcomes[i] == framebuffer::Outcome::Escaped, norms[i]), outcomes[i]};
+        }
+    }
+
+    void probe_row_mpfr(const precision::Viewport<mpreal>& fine, const std::vector<long int>& fx, long int fy, framebuffer::Sample* samples, long int& executed)
+    {
+        mpfr_kernel::Scratch& registers = mpfr_kernel::scratch();
+        registers.set_precision(std::max({fine.real_min.get_prec(), fine.imag_min.get_prec(), fine.width_scale.get_prec(), fine.height_scale.get_prec()}));
+        registers.project(registers.imagc, fine.imag_min, fine.height_scale, fy);
+        for (size_t i = 0; i < fx.size(); i++)
+        {
+            registers.project(registers.realc, fine.real_min, fine.width_scale, fx[i]);
+            mpfr_set_si(registers.zx, 0, MPFR_RNDN);
+            mpfr_set_si(registers.zy, 0, MPFR_RNDN);
+            double norm = 0.0;
+            framebuffer::Outcome outcome;
+            const int iter = mandelbrot.calculate_point_mpfr(registers, 0, view.max_iterations, norm, outcome);
+            executed += iter;
+            samples[i] = {iter, framebuffer::smooth_iterations(iter, outcome == framebuffer::Outcome::Escaped, norm), outcome};
+        }
+    }
+
+    // `fine` holds the offsets from the reference, as in render_perturbed.
+    void probe_row_perturbed(const precision::Viewport<double>& fine, const std::vector<long int>& fx, long int fy, framebuffer::Sample* samples, long int& executed)
+    {
+        const double dci = fine.imag_at(fy);
+        long int rebases = 0;
+        for (size_t i = 0; i < fx.size(); i++)
+        {
+            framebuffer::OrbitState<double> orbit;
+            double norm = 0.0;
+            framebuffer::Outcome outcome;
+            const int iter = mandelbrot.calculate_perturbed(reference, series, fine.real_at(fx[i]), dci, orbit, 0, view.max_iterations, norm, outcome, rebases);
+            executed += iter - series.skip;
+            samples[i] = {iter, framebuffer::smooth_iterations(iter, outcome == framebuffer::Outcome::Escaped, norm), outcome};
+        }
+        frame_rebases += rebases;
+    }
+
+    // Give every cell on an edge that has none its subsamples, one buffer row per task, in the frame's arithmetic.
+    // Returns false if a view change cancelled it.
+    bool supersample_edges()
+    {
+        frame_supersampled_cells = 0;
+        const mpreal half_width = width_scale / 2;
+        const mpreal half_height = height_scale / 2;
+        switch (active_backend)
+        {
+            case precision::Backend::Auto:
+            case precision::Backend::Double:
+            {
+                const precision::Viewport<double> fine{view.real_min, view.imag_min, half_width, half_height};
+                return supersample([this, &fine](auto&&... args){ probe_row_simd(fine, args...); });
+            }
+            case precision::Backend::LongDouble:
+            {
+                const precision::Viewport<long double> fine{view.real_min, view.imag_min, half_width, half_height};
+                return supersample([this, &fine](auto&&... args){ probe_row(fine, args...); });
+            }
+            case precision::Backend::DoubleDouble:
+            {
+                const precision::Viewport<precision::dd_real> fine{view.real_min, view.imag_min, half_width, half_height};
+                return supersample([this, &fine](auto&&... args){ probe_row(fine, args...); });
+            }
+            case precision::Backend::Perturbation:
+            {
+                // A frame whose cells all came from the caches has not computed the reference for its center yet.
+                update_reference({view.real_min - view.real_coordinate, view.imag_min - view.imag_coordinate, width_scale, height_scale});
+                const precision::Viewport<double> fine{view.real_min - view.real_coordinate, view.imag_min - view.imag_coordinate, half_width, half_height};
+                return supersample([this, &fine](auto&&... args){ probe_row_perturbed(fine, args...); });
+            }
+            case precision::Backend::MPFR:
+            {
+                const precision::Viewport<mpreal> fine{view.real_min, view.imag_min, half_width, half_height};
+                return supersample([this, &fine](auto&&... args){ probe_row_mpfr(fine, args...); });
+            }
+        }
+        return true;
+    }
+
+    template<typename Probe_Function>
+    bool supersample(Probe_Function&& probe_row_at)
+    {
+        // Right of, below and diagonally from the cell's own point, in half cells.
+        static constexpr long int offsets[3][2] = {{1, 0}, {0, 1}, {1, 1}};
+
+        std::vector<long int> rows(buffer_height);
+        std::iota(rows.begin(), rows.end(), 0L);
+        std::atomic<bool> cancelled = false;
+        threadPool.run_each(rows, [this, &probe_row_at, &cancelled](long int y){
+            if (cancelled || mandelbrot.outdated(view))
+            {
+                cancelled = true;
+                return;
+            }
+            std::vector<long int> cells;
+            for (long int x = 0; x < buffer_width; x++)
+            {
+                if (!subsamples[y * buffer_width + x].valid && on_edge(x, y))
+                {
+                    cells.push_back(x);
+                }
+            }
+            if (cells.empty())
+            {
+                return;
+            }
+
+            long int executed = 0;
+            std::vector<long int> fx(cells.size());
+            std::vector<framebuffer::Sample> samples(cells.size());
+            for (int i = 0; i < 3; i++)
+            {
+                for (size_t cell = 0; cell < cells.size(); cell++)
+                {
+                    fx[cell] = 2 * cells[cell] + offsets[i][0];
+                }
+                probe_row_at(fx, 2 * (first_row + y) + offsets[i][1], samples.data(), executed);
+                for (size_t cell = 0; cell < cells.size(); cell++)
+                {
+                    framebuffer::Subsamples& extra = subsamples[y * buffer_width + cells[cell]];
+                    extra.iterations[i] = samples[cell].iterations;
+                    extra.smooth[i] = samples[cell].smooth;
+                    extra.outcomes[i] = samples[cell].outcome;
+                }
+            }
+            for (long int x : cells)
+            {
+                subsamples[y * buffer_width + x].valid = true;
+            }
+            frame_supersampled_cells += cells.size();
+            frame_iterations += executed;
+        });
+        return !cancelled;
+    }
+
+    // Pick the cheapest arithmetic that still resolves the current pixel spacing, unless the user forced one.
+    precision::Backend choose_backend()
+    {
+        required_bits = view.required_bits;
+
+        if (backend != precision::Backend::Auto)
+        {
+            return backend;
+        }
+        return precision::select_backend(required_bits, precision::exponent_of(std::min(width_scale, height_scale)));
+    }
+
+    // Compute `frame_view` onto a grid of width by height cells, continuing from the last frame where it can.
+    // Returns false when a view change abandoned the frame part way.
+    bool render(const Mandelbrot::View& frame_view, long int width, long int height)
+    {
+        return render_band(frame_view, width, height, 0, height);
+    }
+
+    // Compute only `rows` rows of that grid, from `top` down. The grid then holds just those.
+    bool render_band(const Mandelbrot::View& frame_view, long int width, long int height, long int top, long int rows)
+    {
+        buffer_width = width;
+        buffer_height = rows;
+        buffer_length = buffer_width * buffer_height;
+        view_rows = height;
+        first_row = top;
+        view = frame_view;
+
+        // Calculate scales for projection.
+        width_scale = view.width / buffer_width;
+        height_scale = view.height / view_rows;
+
+        active_backend = choose_backend();
+        frame_distance = distance_estimation && active_backend != precision::Backend::MPFR;
+        prepare_frame();
+        frame_cancelled = false;
+        frame_iterations = 0;
+        frame_filled_cells = 0;
+        frame_supersampled_cells = 0;
+        frame_escaped = 0;
+        frame_interior = 0;
+        frame_rebases = 0;
+        frame_reference = false;
+        if (stale_cells > 0) switch (active_backend)
+        {
+            case precision::Backend::Auto:
+            case precision::Backend::Double:       render_rows();                     break;
+            case precision::Backend::LongDouble:   render_frame<long double>();       break;
+            case precision::Backend::DoubleDouble: render_frame<precision::dd_real>(); break;
+            case precision::Backend::Perturbation: render_perturbed();                 break;
+            case precision::Backend::MPFR:         render_frame<mpreal>();            break;
+        }
+        if (frame_cancelled || (antialiasing && !frame_distance && !supersample_edges()))
+        {
+            return false;
+        }
+        if (tile_cache.enabled())
+        {
+            store_tiles();
+        }
+        count_exits();
+        return true;
     }
 };
 
@@ -394,39 +2189,50 @@ class Display
 //
 class Renderer
 {
-    private:
-    tp::ThreadPool threadPool{num_threads};
-
     public:
     Mandelbrot& mandelbrot;
     Display& display;
+    Engine engine{mandelbrot};
 
     std::thread thread;
-    bool running = true;
+    std::atomic<bool> running = true;
 
-    // Shading array, this is what the mandelbrot looks like.
-    const char* shade_chars = " .,-~o:;*=><!?HX#$@";
-    unsigned long int shade_char_size = 0;
+    // Shading arrays, this is what the mandelbrot looks like. 'p' steps through them.
+    static constexpr const char* palettes[] = {" .,-~o:;*=><!?HX#$@", " .:-=+*#%@", " .oO@", " -=#"};
+    std::atomic<unsigned long int> palette = 0;
+
+    // Offset into the shade array, advanced while shade cycling is on.
+    std::atomic<unsigned long int> shade_char_size = 0;
     
     // Cycles shades for pulsating appearance.
-    bool shade_cycle_toggle = false;
-    
-    // Scales for conversions between a continous point and a discrete buffer index.
-    mpreal width_scale;
-    mpreal height_scale;
+    std::atomic<bool> shade_cycle_toggle = false;
 
-    // Screen buffer sizes.
-    static long int buffer_width;
-    static long int buffer_height;
-    long int buffer_length = 0;
+    // Glyphs the frames are drawn in, 'g' steps through them. The engine's grid has one cell per sample,
+    // so it is this many times finer than the display's. frame_glyphs is the mode of the frame on the grid.
+    std::atomic<glyphs::Mode> glyph_mode = glyphs::Mode::ASCII;
+    glyphs::Mode frame_glyphs = glyphs::Mode::ASCII;
+
+    // Statistics under the last frame shown, for status messages printed from the user interface.
+    std::mutex stats_mutex;
+    std::string last_stats;
 
     std::chrono::time_point<std::chrono::system_clock> render_start_time = std::chrono::system_clock::now();
 
-    Renderer(Mandelbrot& mandel_ptr, Display& display_ptr) : mandelbrot(mandel_ptr), display(display_ptr)
+    // Metrics of the last frames, only touched by the render thread until it stops. Dumped to trace_path, if set, on exit.
+    metrics::History<256> history;
+    std::string trace_path;
+
+    // Memory the engine's tile cache may take.
+    static constexpr size_t tile_cache_budget = 64 << 20;
+
+    Renderer(Mandelbrot& mandel_ptr, Display& display_ptr, store::TileStore* tile_store = nullptr) : mandelbrot(mandel_ptr), display(display_ptr)
     {
+        engine.tile_cache.set_budget(tile_cache_budget);
+        engine.tile_store = tile_store;
+        engine.preview = [this](long int stride){ show(stride); };
         thread = std::thread(&Renderer::render_loop, this);
-        if (DEBUG) { display.set_print_status_line_length(9); }
-        else { display.set_print_status_line_length(5); }
+        if (DEBUG) { display.set_print_status_line_length(15); }
+        else { display.set_print_status_line_length(6); }
     }
 
     ~Renderer()
@@ -434,67 +2240,228 @@ class Renderer
         running = false;
     }
 
-    // When to render.
-    bool render_clock()
+    // When to render. Sleeps off whatever is left of the frame time since the last render started.
+    void render_clock()
     {
-        const std::chrono::time_point<std::chrono::system_clock> now = std::chrono::system_clock::now();
-        const std::chrono::duration duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - render_start_time);
         // Render time, set for around 60 fps.
-        if(duration.count() > 15)
+        std::this_thread::sleep_until(render_start_time + std::chrono::milliseconds(16));
+        render_start_time = std::chrono::system_clock::now();
+    }
+
+    // Shading pass: turn the iteration buffer into characters. Cheap enough to redo for every palette change or cycle step.
+    // While a progressive frame is at `stride`, stale cells off its grid show the grid cell above and left of them.
+    // Subsamples are averaged in when anti-aliasing is on. In the dot modes each sample becomes one dot of a cell.
+    void shade(std::vector<char32_t>& cells, long int stride)
+    {
+        const char* shade_chars = palettes[palette % std::size(palettes)];
+        const unsigned long int shade_count = std::strlen(shade_chars);
+        const unsigned long int offset = shade_char_size;
+        const long int width = engine.buffer_width;
+        const long int max_iterations = engine.view.max_iterations;
+        const bool smooth_edges = engine.antialiasing && !engine.frame_distance && engine.subsamples.matches(width, engine.buffer_height);
+        const bool distance = engine.frame_distance;
+        static const framebuffer::Subsamples none;
+
+        auto source = [this, stride, width](long int x, long int y){
+            if (stride > 1 && engine.stale[y * width + x])
+            {
+                return (y - y % stride) * width + (x - x % stride);
+            }
+            return y * width + x;
+        };
+
+        if (frame_glyphs == glyphs::Mode::ASCII)
         {
-            render_start_time = now;
-            return true;
+            for (long int buff_pos = 0; buff_pos < engine.buffer_length; buff_pos++)
+            {
+                const long int pos = source(buff_pos % width, buff_pos / width);
+                const framebuffer::Subsamples& extra = smooth_edges ? engine.subsamples[pos] : none;
+                cells[buff_pos] = distance ? framebuffer::distance_char(engine.iteration_buffer[pos], max_iterations, shade_chars, shade_count)
+                                           : framebuffer::shade_char(engine.iteration_buffer[pos], extra, max_iterations, shade_chars, shade_count, offset);
+            }
+            return;
+        }
+
+        const long int across = glyphs::samples_across(frame_glyphs);
+        const long int down = glyphs::samples_down(frame_glyphs);
+        const long int cells_width = width / across;
+        const long int cells_height = engine.buffer_height / down;
+        for (long int cell_y = 0; cell_y < cells_height; cell_y++)
+        {
+            for (long int cell_x = 0; cell_x < cells_width; cell_x++)
+            {
+                uint32_t dots = 0;
+                for (long int dy = 0; dy < down; dy++)
+                {
+                    for (long int dx = 0; dx < across; dx++)
+                    {
+                        const long int x = cell_x * across + dx;
+                        const long int y = cell_y * down + dy;
+                        const long int pos = source(x, y);
+                        const framebuffer::Subsamples& extra = smooth_edges ? engine.subsamples[pos] : none;
+                        const double level = distance ? framebuffer::distance_level(engine.iteration_buffer[pos], max_iterations)
+                                                      : framebuffer::shade_level(engine.iteration_buffer[pos], extra, max_iterations, shade_count, offset);
+                        if (level > glyphs::dither_threshold(x, y))
+                        {
+                            dots |= 1u << (dx + dy * across);
+                        }
+                    }
+                }
+                cells[cell_y * cells_width + cell_x] = glyphs::glyph(frame_glyphs, dots);
+            }
         }
-        return false;
     }
 
-    // Get character from shader array.
-    char get_shade(int iter)
+    // Shade the display's back frame and present it with the current stats. A finished frame passes its
+    // metrics record, to take the shading time and, once the display has printed it, the write time.
+    void show(long int stride = 1, metrics::FrameMetrics* frame = nullptr)
     {
-        if(iter == mandelbrot.maxIterations)
+        if (!engine.iteration_buffer.matches(engine.buffer_width, engine.buffer_height))
         {
-            return ' ';
+            return;
+        }
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        const long int cells_width = engine.buffer_width / glyphs::samples_across(frame_glyphs);
+        const long int cells_height = engine.buffer_height / glyphs::samples_down(frame_glyphs);
+        shade(display.back_frame(cells_width, cells_height).cells, stride);
+        if (frame != nullptr)
+        {
+            frame->shade = std::chrono::steady_clock::now() - start;
+        }
+        collect_written();
+        std::string stats = stats_text(frame);
+        {
+            std::lock_guard<std::mutex> lock_guard{stats_mutex};
+            last_stats = stats;
+        }
+        display.present("\n\r" + stats, frame != nullptr ? frame->frame : 0);
+    }
+
+    // Copy the display's timing of the last frame it printed into that frame's record.
+    void collect_written()
+    {
+        const Display::Written written = display.last_written();
+        if (metrics::FrameMetrics* frame = history.find(written.id))
+        {
+            frame->write = written.time;
+            frame->bytes = written.bytes;
+            frame->written = true;
         }
-        return shade_chars[(iter % sizeof(shade_chars))+shade_char_size];
     }
 
-    // From buffer index calculate the corresponding point on the mandelbrot.
-    void raster_range(int start, int end)
+    // Dump the frame history to the trace file, if one was asked for. Only once the render thread has stopped.
+    void write_trace()
     {
-        for(int buff_pos = start; buff_pos <= end; buff_pos++)
+        if (trace_path.empty())
+        {
+            return;
+        }
+        collect_written();
+        if (!history.write_csv(trace_path))
         {
-            // Convert linear buffer position to plane coords.
-            int buff_x = buff_pos % display.buffer_width;
-            int buff_y = buff_pos / display.buffer_width;
-            
-            // Project buffer position onto mandelbrot.
-            mpreal x = mandelbrot.real_min + buff_x * width_scale;
-            mpreal y = mandelbrot.imag_min + buff_y * height_scale;
-            
-            // Get iteration, assign a shade and place into buffer for display.
-            int iter = mandelbrot.calculate_point( x, y );
-            display.display_buffer[buff_pos] = get_shade( iter );
+            std::cerr << std::format("Could not write {}\n", trace_path);
         }
     }
 
+    // Step to the next forced backend, wrapping back to automatic selection.
+    void cycle_backend()
+    {
+        engine.backend = precision::next_backend(engine.backend);
+        engine.full_render = true;
+        mandelbrot.update();
+    }
+
+    // Step to the next shading array. Only the shading pass runs again.
+    void cycle_palette()
+    {
+        palette++;
+        mandelbrot.update();
+    }
+
+    // Step to the next glyph mode. The grid changes size with it, so the whole frame is computed again.
+    void cycle_glyphs()
+    {
+        glyph_mode = glyphs::next_mode(glyph_mode);
+        mandelbrot.update();
+    }
+
+    // Turn anti-aliasing of edges on or off. Subsamples are kept while it is off, only the shading drops them.
+    void toggle_antialiasing()
+    {
+        engine.antialiasing = !engine.antialiasing;
+        mandelbrot.update();
+    }
+
+    // Turn subdivision of the last pass on or off. Cells it filled in are computed after all.
+    void toggle_subdivision()
+    {
+        engine.subdivision = !engine.subdivision;
+        engine.full_render = true;
+        mandelbrot.update();
+    }
+
+    // Switch between shading by escape count and by estimated distance. Every cell is computed again.
+    void toggle_distance_estimation()
+    {
+        engine.distance_estimation = !engine.distance_estimation;
+        engine.full_render = true;
+        mandelbrot.update();
+    }
+
+    // Turn the series approximation stage of the perturbation renderer on or off.
+    void toggle_series_approximation()
+    {
+        engine.series_approximation = !engine.series_approximation;
+        engine.full_render = true;
+        mandelbrot.update();
+    }
+
     // Thread that checks if mandelbrot needs rendering.
     void render_loop()
     {
         while(running)
         {
-            // If the frametime is right and the mandelbrot has been updated then render it.
-            if(render_clock() && mandelbrot.updated())
+            // Sleep until the mandelbrot has been updated, waking now and then to notice a stop
+            // or to step the shade cycle, which only needs the shading pass.
+            if(!mandelbrot.wait_for_update(std::chrono::milliseconds(100)))
             {
-                std::unique_lock lock(mandelbrot.mutex);
-                
-                // Calculate scales for projection.
-                width_scale = mandelbrot.width / display.buffer_width;
-                height_scale = mandelbrot.height / display.buffer_height;
+                if (shade_cycle_toggle)
+                {
+                    shade_char_size++;
+                    show();
+                }
+                continue;
+            }
 
-                using namespace std::placeholders; 
-                threadPool.create_work_queue(display.buffer_length, std::bind(&Renderer::raster_range, this, _1, _2));
-                display.draw();
-                print_stats("");
+            // If the frametime is right and the mandelbrot has been updated then render it.
+            render_clock();
+            std::chrono::steady_clock::time_point changed_at;
+            if(running && mandelbrot.updated(changed_at))
+            {
+                frame_glyphs = glyph_mode;
+                const long int width = display.buffer_width * glyphs::samples_across(frame_glyphs);
+                const long int height = display.buffer_height * glyphs::samples_down(frame_glyphs);
+                metrics::FrameMetrics& frame = history.push();
+                const std::vector<std::chrono::nanoseconds> busy_before = engine.busy_times();
+                const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                frame.queue_wait = start - changed_at;
+
+                const bool finished = engine.render(mandelbrot.snapshot(width, height), width, height);
+
+                frame.compute = std::chrono::steady_clock::now() - start;
+                const std::vector<std::chrono::nanoseconds> busy_after = engine.busy_times();
+                for (size_t worker = 0; worker < busy_after.size(); worker++)
+                {
+                    frame.busy.push_back(busy_after[worker] - busy_before[worker]);
+                }
+                frame.cells = engine.stale_cells - engine.frame_filled_cells;
+                frame.iterations = engine.frame_iterations;
+                frame.escaped = engine.frame_escaped;
+                frame.interior = engine.frame_interior;
+                if (finished)
+                {
+                    show(1, &frame);
+                }
             }
         }
     }
@@ -503,34 +2470,85 @@ class Renderer
     void stop()
     {
         running = false;
+        mandelbrot.update();
         if(thread.joinable())
         {
             thread.join();
         }
     }
 
-    // Print statistics.
+    // Print the last frame's statistics now, with a status message on top. Called from the user interface.
     void print_stats(std::string stat = "")
     {
+        std::lock_guard<std::mutex> lock_guard{stats_mutex};
+        display.print_stats(stat + "\n\r" + last_stats);
+    }
+
+    // Statistics of the frame being shown, with its timing when it is a finished one.
+    std::string stats_text(const metrics::FrameMetrics* frame = nullptr)
+    {
+        const Mandelbrot::View& view = engine.view;
         std::string s;
-        s += std::format("{}\n\r", stat);
-        s += std::format("depth = {}\n\r", mandelbrot.width.toString());
+        s += std::format("depth = {}\n\r", view.width.toString());
         if(DEBUG)
         {
-            s += std::format("real coord = {}\n\r", mandelbrot.real_coordinate.toString());
-            s += std::format("imag coord = {}\n\r", mandelbrot.imag_coordinate.toString());
-            s += std::format("real_min = {}\n\r",  mandelbrot.real_min.toString());
-            s += std::format("real_max = {}\n\r", mandelbrot.real_max.toString());
-            s += std::format("imag_min = {}\n\r", mandelbrot.imag_min.toString());
-            s += std::format("imag_max = {}\n\r", mandelbrot.imag_max.toString());
+            s += std::format("real coord = {}\n\r", view.real_coordinate.toString());
+            s += std::format("imag coord = {}\n\r", view.imag_coordinate.toString());
+            s += std::format("real_min = {}\n\r",  view.real_min.toString());
+            s += std::format("real_max = {}\n\r", (view.real_min + view.width).toString());
+            s += std::format("imag_min = {}\n\r", view.imag_min.toString());
+            s += std::format("imag_max = {}\n\r", (view.imag_min + view.height).toString());
         }
         else
         {
-            s += std::format("coords = ({}, {}i)\n\r", mandelbrot.real_coordinate.toString(), mandelbrot.imag_coordinate.toString());
+            s += std::format("coords = ({}, {}i)\n\r", view.real_coordinate.toString(), view.imag_coordinate.toString());
         }
-        s += std::format("Iterations = {}\n\r", std::to_string(mandelbrot.maxIterations));
-
-        display.print_stats(s);
+        s += std::format("Iterations = {}, glyphs = {}{}{}\n\r", std::to_string(view.max_iterations), glyphs::mode_name(frame_glyphs),
+                         engine.antialiasing && !engine.frame_distance ? ", anti-aliased" : "", engine.frame_distance ? ", distance estimated" : "");
+        if(DEBUG)
+        {
+            s += std::format("interior exits = {} cardioid/bulb, {} periodic, filled = {}, supersampled = {}, cached = {} ({} tiles{})\n\r",
+                             engine.frame_cardioid_exits, engine.frame_periodic_exits, engine.frame_filled_cells.load(), engine.frame_supersampled_cells.load(),
+                             engine.frame_cached_cells, engine.tile_cache.size(),
+                             engine.tile_store != nullptr ? std::format(", {} stored", engine.tile_store->size()) : "");
+            if (frame != nullptr)
+            {
+                s += std::format("frame {}: wait = {:.1f} ms, compute = {:.1f} ms, shade = {:.1f} ms\n\r", frame->frame,
+                                 metrics::milliseconds(frame->queue_wait), metrics::milliseconds(frame->compute), metrics::milliseconds(frame->shade));
+                s += std::format("cells = {}, iterations = {}, escaped = {}, interior = {}\n\r", frame->cells, frame->iterations, frame->escaped, frame->interior);
+                std::string busy;
+                for (std::chrono::nanoseconds worker : frame->busy)
+                {
+                    busy += std::format(" {:.0f}%", 100.0 * worker.count() / std::max<int64_t>(1, frame->compute.count()));
+                }
+                s += std::format("workers busy ={}\n\r", busy);
+            }
+            else
+            {
+                s += "\n\r\n\r\n\r";
+            }
+            if (const metrics::FrameMetrics* printed = history.last_written())
+            {
+                s += std::format("frame {} written: {:.2f} ms, {} bytes\n\r", printed->frame, metrics::milliseconds(printed->write), printed->bytes);
+            }
+            else
+            {
+                s += "\n\r";
+            }
+        }
+        s += std::format("precision = {}{} ({} bits, {} needed)", precision::backend_name(engine.active_backend), engine.backend == precision::Backend::Auto ? "" : " [forced]",
+                         precision::working_bits(engine.active_backend, engine.required_bits), engine.required_bits);
+        if (engine.active_backend == precision::Backend::Double)
+        {
+            s += std::format(", {}", simd::isa_name(engine.isa));
+        }
+        if (engine.active_backend == precision::Backend::Perturbation)
+        {
+            s += std::format(", reference = {} iterations, rebases = {}", engine.reference.last(), engine.frame_rebases.load());
+            s += engine.series_approximation ? std::format(", series skipped = {}", engine.series.skip) : ", series off";
+        }
+        s += "\n\r";
+        return s;
     }
 };
 
@@ -548,7 +2566,8 @@ class UserInterface
     void Navigate()
     {
         keypad(stdscr, TRUE);
-        clear();
+        display.clear_screen();
+        mandelbrot.update();
         noecho();
         // Hold the keyboards input value.
         int c;
@@ -588,9 +2607,43 @@ class UserInterface
                     break;
                 case 67: // uppercase C
                 case 99: // lowercase c
-                    // Broke with the refactoring. Not yet implemented.
-                    // print_status("Toggle Shade Cycling");
-                    // toggle_shade_cycle();
+                    print_status("Toggle Shade Cycling");
+                    toggle_shade_cycle();
+                    break;
+                case 80: // uppercase P
+                case 112: // lowercase p
+                    print_status("Next palette");
+                    renderer.cycle_palette();
+                    break;
+                case 66:	// uppercase B
+                case 98:	// lowercase b
+                    renderer.cycle_backend();
+                    print_status(std::format("Precision backend: {}", precision::backend_name(renderer.engine.backend)));
+                    break;
+                case 83:	// uppercase S
+                case 115:	// lowercase s
+                    renderer.toggle_series_approximation();
+                    print_status(renderer.engine.series_approximation ? "Series approximation on" : "Series approximation off");
+                    break;
+                case 77:	// uppercase M
+                case 109:	// lowercase m
+                    renderer.toggle_subdivision();
+                    print_status(renderer.engine.subdivision ? "Subdivision on" : "Subdivision off");
+                    break;
+                case 71:	// uppercase G
+                case 103:	// lowercase g
+                    renderer.cycle_glyphs();
+                    print_status(std::format("Glyphs: {}", glyphs::mode_name(renderer.glyph_mode)));
+                    break;
+                case 65:	// uppercase A
+                case 97:	// lowercase a
+                    renderer.toggle_antialiasing();
+                    print_status(renderer.engine.antialiasing ? "Anti-aliasing on" : "Anti-aliasing off");
+                    break;
+                case 68:	// uppercase D
+                case 100:	// lowercase d
+                    renderer.toggle_distance_estimation();
+                    print_status(renderer.engine.distance_estimation ? "Distance estimation on" : "Distance estimation off");
                     break;
                 case 88: 	// uppercase X
                 case 120: 	// lowercase X
@@ -634,6 +2687,7 @@ class UserInterface
 
             try
             {
+                real.set_prec(precision::parse_bits(c_real));
                 real = c_real;
                 break;
             }
@@ -669,6 +2723,7 @@ class UserInterface
 
             try
             {
+                imag.set_prec(precision::parse_bits(c_imag));
                 imag = c_imag;
                 break;
             }
@@ -724,6 +2779,7 @@ class UserInterface
     void toggle_shade_cycle()
     {
         renderer.shade_cycle_toggle = !renderer.shade_cycle_toggle;
+        mandelbrot.update();
     }
 
     void print_status(std::string s)
@@ -749,9 +2805,14 @@ class AsciiMandelbrot
     public:
     Display display;
     Mandelbrot mandelbrot;
-    Renderer renderer{mandelbrot, display};
+    Renderer renderer;
     UserInterface userInterface{mandelbrot, display, renderer};
 
+    explicit
+    AsciiMandelbrot(store::TileStore* tile_store = nullptr) : renderer{mandelbrot, display, tile_store}
+    {
+    }
+
     void run()
     {
         userInterface.Navigate();
@@ -760,25 +2821,516 @@ class AsciiMandelbrot
     void stop()
     {   
         renderer.stop();
+        display.stop();
         endwin();
+        renderer.write_trace();
     }
 
-    AsciiMandelbrot(int prec)
+    ~AsciiMandelbrot()
     {
-        mpreal::set_default_prec(mpfr::digits2bits(prec));
+        stop();
     }
+};
 
-    ~AsciiMandelbrot()
+// --bench-mpfr: iterate one row across the set's boundary with the MPFR register kernel and with the
+// mpreal expression version, and report the time and the GMP heap allocations per iteration of each.
+int bench_mpfr(int digits_of_precision)
+{
+    alloc::install_gmp_counter();
+    mpreal::set_default_prec(mpfr::digits2bits(digits_of_precision));
+
+    Mandelbrot mandelbrot;
+    const long int max_iterations = 1000;
+    const long int cells = 256;
+    const mpreal real_min = -0.8;
+    const mpreal scale = mpreal(0.1) / cells;
+    const mpreal imag = 0.15;
+
+    mpfr_kernel::Scratch& registers = mpfr_kernel::scratch();
+    registers.set_precision(mpreal::get_default_prec());
+    mpfr_set(registers.imagc, imag.mpfr_srcptr(), MPFR_RNDN);
+
+    auto report = [](const char* name, long int iterations, unsigned long int allocations, std::chrono::steady_clock::duration elapsed){
+        std::cout << std::format("{:<10} {:>9} iterations {:>8.3f} s {:>10} gmp allocations ({:.3f} per iteration)\n",
+                                 name, iterations, std::chrono::duration<double>(elapsed).count(), allocations,
+                                 static_cast<double>(allocations) / std::max(1L, iterations));
+    };
+
+    long int iterations = 0;
+    unsigned long int allocations = alloc::gmp_allocations;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (long int x = 0; x < cells; x++)
     {
-        stop();
+        registers.project(registers.realc, real_min, scale, x);
+        mpfr_set_si(registers.zx, 0, MPFR_RNDN);
+        mpfr_set_si(registers.zy, 0, MPFR_RNDN);
+        double norm = 0.0;
+        framebuffer::Outcome outcome;
+        iterations += mandelbrot.calculate_point_mpfr(registers, 0, max_iterations, norm, outcome);
+    }
+    report("registers", iterations, alloc::gmp_allocations - allocations, std::chrono::steady_clock::now() - start);
+
+    iterations = 0;
+    allocations = alloc::gmp_allocations;
+    start = std::chrono::steady_clock::now();
+    for (long int x = 0; x < cells; x++)
+    {
+        const mpreal realc = real_min + scale * x;
+        framebuffer::OrbitState<mpreal> state;
+        double norm = 0.0;
+        framebuffer::Outcome outcome;
+        iterations += mandelbrot.calculate_point(realc, imag, state, 0, max_iterations, norm, outcome);
+    }
+    report("mpreal", iterations, alloc::gmp_allocations - allocations, std::chrono::steady_clock::now() - start);
+    return 0;
+}
+
+// Settings of a headless render, from the command line.
+struct BatchOptions
+{
+    std::string output;
+    std::optional<image::Format> format;
+    std::string real = "-0.5";
+    std::string imag = "0";
+    std::string width = "3";
+    std::string height;
+    long int iterations = 500;
+    long int columns = 1024;
+    long int rows = 768;
+    precision::Backend backend = precision::Backend::Auto;
+
+    // Rows computed and written at a time. 0 is 64 for a single image and whole frames for a zoom sequence,
+    // so that each frame can take cells over from the one before.
+    long int band_rows = 0;
+
+    // Frames of a zoom sequence toward the center, each zoomed in by the zoom factor. Numbered files unless streamed.
+    long int frames = 1;
+    std::string zoom_factor;
+    bool stream = false;
+
+    // Fill uniform rectangles in from their border, see Engine::subdivision. Off by default: the filled cells share one
+    // smooth escape count and which ones get filled depends on where bands start, so the output is no longer exact.
+    bool subdivide = false;
+
+    // Supersample edges, see Engine::antialiasing. Cells on the first and last row of a band only compare with
+    // the neighbours in their band, so where bands start changes which of them are supersampled.
+    bool antialias = false;
+};
+
+const char* batch_usage =
+    "usage: asciimandelbrot --render FILE [--format raw|pgm|ascii] [--real RE] [--imag IM] [--width W]\n"
+    "                       [--height H] [--iterations N] [--size COLUMNSxROWS] [--precision BACKEND] [--band ROWS]\n"
+    "                       [--frames N] [--zoom-factor F] [--stream] [--subdivide] [--antialias]\n"
+    "       asciimandelbrot --bench [--threads N] [--precision BACKEND]\n"
+    "       asciimandelbrot --bench-mpfr\n"
+    "       asciimandelbrot [--debug] [--trace FILE] [--tile-store FILE]\n";
+
+// Read batch options from the command line. Returns false, with a message, on anything it does not understand.
+bool parse_batch_options(const std::vector<std::string_view>& args, BatchOptions& options)
+{
+    try
+    {
+        for (size_t i = 0; i < args.size(); i++)
+        {
+            const std::string_view option = args[i];
+            if (option == "--stream")
+            {
+                options.stream = true;
+                continue;
+            }
+            if (option == "--subdivide")
+            {
+                options.subdivide = true;
+                continue;
+            }
+            if (option == "--antialias")
+            {
+                options.antialias = true;
+                continue;
+            }
+            if (++i >= args.size())
+            {
+                std::cerr << std::format("{} needs a value\n", option);
+                return false;
+            }
+            const std::string value{args[i]};
+
+            if (option == "--render")           { options.output = value; }
+            else if (option == "--real")        { options.real = value; }
+            else if (option == "--imag")        { options.imag = value; }
+            else if (option == "--width")       { options.width = value; }
+            else if (option == "--height")      { options.height = value; }
+            else if (option == "--iterations")  { options.iterations = std::stol(value); }
+            else if (option == "--band")        { options.band_rows = std::stol(value); }
+            else if (option == "--frames")      { options.frames = std::stol(value); }
+            else if (option == "--zoom-factor") { options.zoom_factor = value; }
+            else if (option == "--size")
+            {
+                const size_t x = value.find('x');
+                if (x == std::string::npos)
+                {
+                    std::cerr << std::format("bad size {}, expected COLUMNSxROWS\n", value);
+                    return false;
+                }
+                options.columns = std::stol(value.substr(0, x));
+                options.rows = std::stol(value.substr(x + 1));
+            }
+            else if (option == "--format")
+            {
+                options.format = image::parse_format(value);
+                if (!options.format)
+                {
+                    std::cerr << std::format("unknown format {}\n", value);
+                    return false;
+                }
+            }
+            else if (option == "--precision")
+            {
+                const std::optional<precision::Backend> backend = precision::parse_backend(value);
+                if (!backend)
+                {
+                    std::cerr << std::format("unknown precision {}\n", value);
+                    return false;
+                }
+                options.backend = *backend;
+            }
+            else
+            {
+                std::cerr << std::format("unknown option {}\n", option);
+                return false;
+            }
+        }
+    }
+    catch(...)
+    {
+        std::cerr << "option values must be numbers\n";
+        return false;
+    }
+
+    if (options.output.empty())
+    {
+        std::cerr << "--render FILE is required\n";
+        return false;
+    }
+    if (!options.format)
+    {
+        options.format = image::format_for(options.output);
+        if (!options.format)
+        {
+            std::cerr << std::format("cannot tell the format of {}, use --format\n", options.output);
+            return false;
+        }
+    }
+    if (options.iterations < 1 || options.columns < 1 || options.rows < 1 || options.band_rows < 0 || options.frames < 1)
+    {
+        std::cerr << "iterations, size, band and frames must be positive\n";
+        return false;
+    }
+    return true;
+}
+
+// Parse a number given on the command line at the precision its digits need.
+mpreal parse_real(const std::string& text)
+{
+    mpreal value;
+    value.set_prec(precision::parse_bits(text.c_str()));
+    value = text.c_str();
+    return value;
+}
+
+// Point the mandelbrot at the first view the options describe.
+void set_up_view(Mandelbrot& mandelbrot, const BatchOptions& options)
+{
+    // Without a height the cells come out square on the page.
+    const mpreal plane_width = parse_real(options.width);
+    const mpreal plane_height = options.height.empty()
+        ? plane_width * options.rows / options.columns * image::cell_aspect(*options.format)
+        : parse_real(options.height);
+
+    mandelbrot.set_coords(parse_real(options.real), parse_real(options.imag));
+    mandelbrot.set_extent(plane_width, plane_height);
+    mandelbrot.set_max_iterations(options.iterations);
+    if (!options.zoom_factor.empty())
+    {
+        mandelbrot.set_zoom_factor(parse_real(options.zoom_factor));
+    }
+}
+
+// A zoom sequence shares one reference orbit. It is computed up front for the center at the deepest frame's
+// precision, which every shallower frame's center also fits in, so perturbation never recomputes it.
+void share_reference(Engine& engine, const BatchOptions& options)
+{
+    Mandelbrot deepest;
+    set_up_view(deepest, options);
+    for (long int frame = 1; frame < options.frames; frame++)
+    {
+        deepest.zoom();
+    }
+    const Mandelbrot::View view = deepest.snapshot(options.columns, options.rows);
+    const precision::Backend backend = options.backend != precision::Backend::Auto ? options.backend
+        : precision::select_backend(view.required_bits, precision::exponent_of(std::min(view.width / options.columns, view.height / options.rows)));
+
+    if (backend == precision::Backend::Perturbation || (options.backend == precision::Backend::Auto && backend == precision::Backend::MPFR))
+    {
+        engine.reference.compute(view.real_coordinate, view.imag_coordinate, view.max_iterations);
+    }
+}
+
+// Headless render into files, with no terminal involved: one image, or a zoom sequence toward its center.
+// Frames are computed and written a band of rows at a time through the same engine as the terminal view,
+// so only one band is ever held in memory. Each frame of a sequence keeps the cells of the last one whose
+// points it shares.
+int render_batch(const BatchOptions& options)
+{
+    Mandelbrot mandelbrot;
+    set_up_view(mandelbrot, options);
+
+    // Nothing else runs in batch mode, so every hardware thread computes.
+    Engine engine{mandelbrot, std::max(1U, std::thread::hardware_concurrency())};
+    engine.backend = options.backend;
+    engine.subdivision = options.subdivide;
+    engine.antialiasing = options.antialias;
+    if (options.frames > 1)
+    {
+        share_reference(engine, options);
+    }
+
+    const bool sequence = options.frames > 1;
+    const long int band_rows = options.band_rows > 0 ? options.band_rows : sequence ? options.rows : 64;
+    image::BandWriter writer{*options.format, options.iterations, Renderer::palettes[0]};
+    long int resampled_cells = 0;
+    long int supersampled_cells = 0;
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (long int frame = 0; frame < options.frames; frame++)
+    {
+        const std::string path = sequence && !options.stream ? image::frame_path(options.output, frame) : options.output;
+        if ((frame == 0 || !options.stream) && !writer.open(path))
+        {
+            std::cerr << std::format("cannot write {}\n", path);
+            return 1;
+        }
+        writer.begin_frame(options.columns, options.rows);
+
+        // Every band is projected from the whole frame's view, so the file is the same whatever the band height.
+        const std::chrono::steady_clock::time_point frame_start = std::chrono::steady_clock::now();
+        const Mandelbrot::View frame_view = mandelbrot.snapshot(options.columns, options.rows);
+        long int frame_resampled = 0;
+        for (long int band_y = 0; band_y < options.rows; band_y += band_rows)
+        {
+            const long int band_height = std::min(band_rows, options.rows - band_y);
+            engine.render_band(frame_view, options.columns, options.rows, band_y, band_height);
+            frame_resampled += engine.frame_resampled_cells;
+            supersampled_cells += engine.frame_supersampled_cells;
+            writer.write(engine.iteration_buffer, options.antialias ? &engine.subsamples : nullptr);
+        }
+        if (!writer.good())
+        {
+            std::cerr << std::format("cannot write {}\n", path);
+            return 1;
+        }
+
+        resampled_cells += frame_resampled;
+        if (sequence)
+        {
+            std::cerr << std::format("{}: depth = {}, precision = {} ({} bits needed), {:.3f} s, {} cells resampled\n", path,
+                                     frame_view.width.toString(), precision::backend_name(engine.active_backend), engine.required_bits,
+                                     std::chrono::duration<double>(std::chrono::steady_clock::now() - frame_start).count(), frame_resampled);
+            mandelbrot.zoom();
+        }
     }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const long int cells = options.columns * options.rows * options.frames;
+    std::cerr << std::format("{}: {} frame{} of {}x{} cells, {} iterations, precision = {} ({} bits needed), {:.3f} s, {:.2f} Mcells/s",
+                             options.output, options.frames, sequence ? "s" : "", options.columns, options.rows, options.iterations,
+                             precision::backend_name(engine.active_backend), engine.required_bits, seconds, cells / seconds / 1e6);
+    if (sequence)
+    {
+        std::cerr << std::format(", {} cells resampled", resampled_cells);
+    }
+    if (options.antialias)
+    {
+        std::cerr << std::format(", {} cells supersampled", supersampled_cells);
+    }
+    if (engine.reference.last() >= 0)
+    {
+        std::cerr << std::format(", reference = {} iterations", engine.reference.last());
+    }
+    std::cerr << "\n";
+    return 0;
+}
+
+// A view of the benchmark suite.
+struct BenchView
+{
+    const char* name;
+    const char* real;
+    const char* imag;
+    const char* width;
+    long int iterations;
+};
+
+// Canonical views, from cheap to deep. The deep ones zoom into c = i, a Misiurewicz point: the boundary
+// there has structure at every depth, and the center is exact at any precision.
+const BenchView bench_views[] = {
+    {"full-set",        "-0.5",              "0",                 "3",      1000},
+    {"seahorse-valley", "-0.743643887037151", "0.131825904205330", "0.005",  2000},
+    {"interior",        "-0.1225",           "0.7449",            "0.1",    5000},
+    {"zoom-1e-30",      "0",                 "1",                 "1e-30",  5000},
+    {"zoom-1e-200",     "0",                 "1",                 "1e-200", 5000},
 };
 
+// --bench: render every view of the suite headlessly at a fixed grid size, and print throughput,
+// GMP allocations and per worker utilisation as JSON. --threads and --precision pick the workers
+// and the backend, so runs on different machines or with different kernels can be compared.
+int bench(const std::vector<std::string_view>& args)
+{
+    uint32_t thread_count = std::max(1U, std::thread::hardware_concurrency());
+    precision::Backend backend = precision::Backend::Auto;
+    bool subdivide = false;
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        const std::string value = i + 1 < args.size() ? std::string(args[i + 1]) : "";
+        const std::optional<precision::Backend> parsed = precision::parse_backend(value);
+        if (args[i] == "--threads" && std::atol(value.c_str()) > 0)
+        {
+            thread_count = std::atol(value.c_str());
+            i++;
+        }
+        else if (args[i] == "--precision" && parsed)
+        {
+            backend = *parsed;
+            i++;
+        }
+        else if (args[i] == "--subdivide")
+        {
+            subdivide = true;
+        }
+        else
+        {
+            std::cerr << "usage: asciimandelbrot --bench [--threads N] [--precision BACKEND] [--subdivide]\n";
+            return 2;
+        }
+    }
+
+    alloc::install_gmp_counter();
+    const long int columns = 320;
+    const long int rows = 240;
+
+    std::string json = std::format("{{\n  \"threads\": {},\n  \"precision\": \"{}\",\n  \"isa\": \"{}\",\n  \"subdivide\": {},\n  \"columns\": {},\n  \"rows\": {},\n  \"views\": [",
+                                   thread_count, precision::backend_name(backend), simd::isa_name(simd::detect()), subdivide ? "true" : "false", columns, rows);
+    for (const BenchView& bench_view : bench_views)
+    {
+        BatchOptions options;
+        options.format = image::Format::Raw;
+        options.real = bench_view.real;
+        options.imag = bench_view.imag;
+        options.width = bench_view.width;
+        options.iterations = bench_view.iterations;
+        options.columns = columns;
+        options.rows = rows;
+
+        // A fresh engine for every view, so nothing carries over from the last one.
+        Mandelbrot mandelbrot;
+        set_up_view(mandelbrot, options);
+        Engine engine{mandelbrot, thread_count};
+        engine.backend = backend;
+        engine.subdivision = subdivide;
+        const Mandelbrot::View view = mandelbrot.snapshot(columns, rows);
+
+        const unsigned long int allocations = alloc::gmp_allocations;
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        engine.render(view, columns, rows);
+        const std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+        const unsigned long int frame_allocations = alloc::gmp_allocations - allocations;
+
+        // Iterations actually executed. Cells subdivision filled ran none, and the iterations the series approximation
+        // skipped are counted apart, as only perturbation skips any.
+        const long int iterations = engine.frame_iterations;
+        const long int skipped = engine.active_backend == precision::Backend::Perturbation
+                               ? engine.series.skip * (columns * rows - engine.frame_filled_cells) : 0;
+
+        const double seconds = std::chrono::duration<double>(elapsed).count();
+        std::string utilisation;
+        for (std::chrono::nanoseconds busy : engine.busy_times())
+        {
+            utilisation += std::format("{}{:.3f}", utilisation.empty() ? "" : ", ", busy.count() / std::max(1.0, static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count())));
+        }
+
+        json += std::format("{}\n    {{\"name\": \"{}\", \"real\": \"{}\", \"imag\": \"{}\", \"width\": \"{}\", \"iterations\": {}, "
+                            "\"backend\": \"{}\", \"bits\": {}, \"seconds\": {:.6f}, \"pixels_per_second\": {:.0f}, "
+                            "\"iterations_per_second\": {:.0f}, \"total_iterations\": {}, \"skipped_iterations\": {}, \"filled_cells\": {}, "
+                            "\"gmp_allocations\": {}, \"utilisation\": [{}]}}",
+                            &bench_view == bench_views ? "" : ",", bench_view.name, bench_view.real, bench_view.imag, bench_view.width,
+                            bench_view.iterations, precision::backend_name(engine.active_backend), engine.required_bits, seconds,
+                            columns * rows / seconds, iterations / seconds, iterations, skipped, engine.frame_filled_cells.load(),
+                            frame_allocations, utilisation);
+    }
+    json += "\n  ]\n}\n";
+    std::cout << json;
+    return 0;
+}
+
+// Tests that exercise the engine include this file with ASCIIMANDELBROT_NO_MAIN defined, see tests/.
+#ifndef ASCIIMANDELBROT_NO_MAIN
 int main(int argc, char *argv[])
 {
-    int digits_of_precision = 500;
+    const std::vector<std::string_view> args(argv + 1, argv + argc);
+    if (!args.empty() && args[0] == "--bench-mpfr")
+    {
+        return bench_mpfr(500);
+    }
+    if (!args.empty() && args[0] == "--bench")
+    {
+        return bench({args.begin() + 1, args.end()});
+    }
+
+    // --debug, --trace and --tile-store only change the terminal UI, anything else is a batch render.
+    std::string trace_path;
+    std::string tile_store_path;
+    bool interactive = true;
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        if (args[i] == "--debug")
+        {
+            DEBUG = true;
+        }
+        else if (args[i] == "--trace" && i + 1 < args.size())
+        {
+            trace_path = args[++i];
+        }
+        else if (args[i] == "--tile-store" && i + 1 < args.size())
+        {
+            tile_store_path = args[++i];
+        }
+        else
+        {
+            interactive = false;
+        }
+    }
+    if (!interactive)
+    {
+        BatchOptions options;
+        if (!parse_batch_options(args, options))
+        {
+            std::cerr << batch_usage;
+            return 2;
+        }
+        return render_batch(options);
+    }
+
+    // Outlives the app, so the render thread is done with it before it closes.
+    store::TileStore tile_store;
+    if (!tile_store_path.empty() && !tile_store.open(tile_store_path))
+    {
+        std::cerr << std::format("cannot open tile store {}\n", tile_store_path);
+        return 1;
+    }
 
-    AsciiMandelbrot app(digits_of_precision);
+    AsciiMandelbrot app{tile_store.is_open() ? &tile_store : nullptr};
+    app.renderer.trace_path = trace_path;
 
     app.run();
 }
+#endif
@@ -0,0 +1,98 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <string_view>
+#include <format>
+#include <cerrno>
+#include <unistd.h>
+#include "glyphs.hpp"
+
+
+namespace terminal
+{
+
+    //
+    // Turns a frame of character cells into the bytes that bring the terminal from the last frame to it:
+    // cursor moves to each changed run and the run itself, in UTF-8. Nothing is sent for cells that are already shown.
+    //
+    struct FrameEncoder
+    {
+        // Unchanged cells between two changed runs are sent as they are when that is shorter than a cursor move.
+        static constexpr long int max_gap = 8;
+
+        long int width = 0;
+        long int height = 0;
+
+        // What the terminal shows, as far as the encoder knows.
+        std::vector<char32_t> shown;
+
+        // Bytes of the last frame.
+        std::string bytes;
+
+        // Forget what is on screen, e.g. after a resize or a clear. The next frame is sent whole.
+        void invalidate()
+        {
+            shown.clear();
+        }
+
+        // Encode the frame's differences from the last one into `bytes`, and remember it as shown.
+        const std::string& encode(const std::vector<char32_t>& frame, long int frame_width, long int frame_height)
+        {
+            bytes.clear();
+            if (frame_width != width || frame_height != height || shown.size() != frame.size())
+            {
+                width = frame_width;
+                height = frame_height;
+                shown.assign(frame.size(), U'\0');
+            }
+
+            for (long int y = 0; y < height; y++)
+            {
+                const char32_t* row = frame.data() + y * width;
+                char32_t* shown_row = shown.data() + y * width;
+
+                // Column the cursor is at after the last byte sent on this row, -1 before anything was sent.
+                long int cursor = -1;
+                for (long int x = 0; x < width; x++)
+                {
+                    if (row[x] == shown_row[x])
+                    {
+                        continue;
+                    }
+                    if (cursor >= 0 && x - cursor <= max_gap)
+                    {
+                        for (long int gap = cursor; gap < x; gap++)
+                        {
+                            glyphs::append_utf8(bytes, row[gap]);
+                        }
+                    }
+                    else
+                    {
+                        bytes += std::format("\033[{};{}H", y + 1, x + 1);
+                    }
+                    glyphs::append_utf8(bytes, row[x]);
+                    shown_row[x] = row[x];
+                    cursor = x + 1;
+                }
+            }
+            return bytes;
+        }
+    };
+
+    // Write all of `bytes` to fd in as few calls as the kernel allows, retrying partial writes and interrupts.
+    inline bool write_all(int fd, std::string_view bytes)
+    {
+        while (!bytes.empty())
+        {
+            const ssize_t written = ::write(fd, bytes.data(), bytes.size());
+            if (written < 0)
+            {
+                if (errno == EINTR) { continue; }
+                return false;
+            }
+            bytes.remove_prefix(written);
+        }
+        return true;
+    }
+
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include <array>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <cstdint>
+
+
+namespace metrics
+{
+    using nanoseconds = std::chrono::nanoseconds;
+
+    // Where one frame's time went, and what it computed.
+    struct FrameMetrics
+    {
+        uint64_t frame = 0;
+
+        // From the view change to the start of computing: frame pacing and whatever frame ran before.
+        nanoseconds queue_wait{0};
+
+        // Computing the cells, including drawing the previews of a progressive frame.
+        nanoseconds compute{0};
+
+        // Shading the finished frame into characters.
+        nanoseconds shade{0};
+
+        // Encoding and writing the frame to the terminal, and the bytes that took. Filled in once it was printed.
+        nanoseconds write{0};
+        size_t bytes = 0;
+        bool written = false;
+
+        // Cells iterated, not filled in, the iterations they executed, and how the cells on screen ended.
+        long int cells = 0;
+        long int iterations = 0;
+        long int escaped = 0;
+        long int interior = 0;
+
+        // Time each worker spent computing.
+        std::vector<nanoseconds> busy;
+    };
+
+    inline double milliseconds(nanoseconds duration)
+    {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    }
+
+    //
+    // The last Capacity frames' metrics. Slots are reused in place, so recording a frame costs a copy and
+    // no allocation once the ring has gone round. Not synchronized, one thread records and reads it.
+    //
+    template<size_t Capacity>
+    struct History
+    {
+        std::array<FrameMetrics, Capacity> frames;
+        uint64_t count = 0;
+
+        // Start the next frame's record, overwriting the oldest one.
+        FrameMetrics& push()
+        {
+            FrameMetrics& metrics = frames[count % Capacity];
+            std::vector<nanoseconds> busy = std::move(metrics.busy);
+            metrics = FrameMetrics{};
+            metrics.busy = std::move(busy);
+            metrics.busy.clear();
+            metrics.frame = ++count;
+            return metrics;
+        }
+
+        // Record of the given frame, if it is still kept.
+        FrameMetrics* find(uint64_t frame)
+        {
+            if (frame == 0 || frame > count || count - frame >= Capacity)
+            {
+                return nullptr;
+            }
+            return &frames[(frame - 1) % Capacity];
+        }
+
+        // Most recent record that has been printed, if any.
+        const FrameMetrics* last_written() const
+        {
+            for (uint64_t frame = count; frame > 0 && count - frame < Capacity; frame--)
+            {
+                const FrameMetrics& metrics = frames[(frame - 1) % Capacity];
+                if (metrics.written)
+                {
+                    return &metrics;
+                }
+            }
+            return nullptr;
+        }
+
+        // Dump the kept records, oldest first, as CSV. Worker busy times share one column, separated by spaces.
+        bool write_csv(const std::string& path) const
+        {
+            std::ofstream file(path);
+            file << "frame,queue_wait_ms,compute_ms,shade_ms,write_ms,bytes,cells,iterations,escaped,interior,busy_ms\n";
+            const uint64_t first = count > Capacity ? count - Capacity + 1 : 1;
+            for (uint64_t frame = first; frame <= count; frame++)
+            {
+                const FrameMetrics& metrics = frames[(frame - 1) % Capacity];
+                std::string busy;
+                for (nanoseconds worker : metrics.busy)
+                {
+                    busy += std::format("{}{:.3f}", busy.empty() ? "" : " ", milliseconds(worker));
+                }
+                // Frames never printed, because they were cancelled or replaced first, leave the write columns empty.
+                const std::string write = metrics.written ? std::format("{:.3f}", milliseconds(metrics.write)) : "";
+                const std::string bytes = metrics.written ? std::to_string(metrics.bytes) : "";
+                file << std::format("{},{:.3f},{:.3f},{:.3f},{},{},{},{},{},{},{}\n", metrics.frame,
+                                    milliseconds(metrics.queue_wait), milliseconds(metrics.compute), milliseconds(metrics.shade),
+                                    write, bytes, metrics.cells, metrics.iterations, metrics.escaped, metrics.interior, busy);
+            }
+            return file.good();
+        }
+    };
+
+}
@@ -0,0 +1,247 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include "tile_scheduler.hpp"
+
+
+namespace framebuffer
+{
+
+    // How a cell's orbit ended. Only Bounded ones are continued when the iteration limit grows,
+    // the others are final for any limit.
+    enum class Outcome : uint8_t
+    {
+        Bounded,    // Stopped at the iteration limit, or not computed yet.
+        Escaped,    // Left the escape radius.
+        Cardioid,   // c lies in the main cardioid or the period 2 bulb.
+        Periodic    // The orbit was caught cycling.
+    };
+
+    inline bool is_interior(Outcome outcome)
+    {
+        return outcome == Outcome::Cardioid || outcome == Outcome::Periodic;
+    }
+
+    // What the render stage found out about one cell. Shading only ever reads these.
+    struct Sample
+    {
+        // Iterations done so far. For a cell that has not escaped this is where its orbit stopped.
+        int32_t iterations = 0;
+
+        // Fractional escape count, continuous across iteration bands. Equals iterations for cells that never escaped.
+        float smooth = 0.0f;
+
+        Outcome outcome = Outcome::Bounded;
+
+        // Copied from the uniform border of a rectangle around it, or from the tile cache, instead of iterated. Such a cell
+        // has no orbit to continue, a Bounded one starts over when the iteration limit is raised.
+        bool no_orbit = false;
+
+        // With distance estimation, a lower bound on how far an escaped cell's point is from the set, in cell widths.
+        float distance = 0.0f;
+    };
+
+    // Extra samples of a cell on an edge, at the half-cell points right of, below and diagonally from its own,
+    // for anti-aliasing. Nothing of their orbits is kept, they are computed again once the limit is raised.
+    struct Subsamples
+    {
+        int32_t iterations[3] = {};
+        float smooth[3] = {};
+        Outcome outcomes[3] = {};
+        bool valid = false;
+
+        Sample operator[](int i) const { return {iterations[i], smooth[i], outcomes[i]}; }
+    };
+
+    inline bool escaped(const Sample& sample, long int max_iterations)
+    {
+        return sample.outcome == Outcome::Escaped && sample.iterations < max_iterations;
+    }
+
+    // iterations + 1 - log2(log|z|) for an orbit that escaped with |z|^2 = norm.
+    inline float smooth_iterations(long int iterations, bool escaped, double norm)
+    {
+        if (!escaped || norm <= 1.0)
+        {
+            return static_cast<float>(iterations);
+        }
+        return static_cast<float>(iterations + 1 - std::log2(0.5 * std::log(norm)));
+    }
+
+    // Where an escaped sample falls on the shading array, which wraps: its smooth escape count plus the cycling offset,
+    // modulo the array's length. Whole numbers land on the characters, so bands of one escape count blend into the next.
+    inline double shade_position(const Sample& sample, unsigned long int shade_count, unsigned long int offset)
+    {
+        return std::fmod(std::max(0.0, static_cast<double>(sample.smooth)) + offset, static_cast<double>(shade_count));
+    }
+
+    // Character for a sample from a shading array. Cells that never escaped within max_iterations are blank.
+    inline char shade_char(const Sample& sample, long int max_iterations, const char* shade_chars, unsigned long int shade_count, unsigned long int offset)
+    {
+        if (!escaped(sample, max_iterations))
+        {
+            return ' ';
+        }
+        return shade_chars[static_cast<unsigned long int>(shade_position(sample, shade_count, offset))];
+    }
+
+    // How much ink a sample puts down, from 0 for the first, blank character of the shading array to 1 for the last,
+    // the arrays going from light to dense. Between two characters it is interpolated, and past the last one it falls
+    // back to the first, so the dithered glyph modes shade the smooth count without steps.
+    inline double shade_level(const Sample& sample, long int max_iterations, unsigned long int shade_count, unsigned long int offset)
+    {
+        if (!escaped(sample, max_iterations) || shade_count < 2)
+        {
+            return 0.0;
+        }
+        const double position = shade_position(sample, shade_count, offset);
+        const double last = static_cast<double>(shade_count - 1);
+        return position <= last ? position / last : std::clamp(static_cast<double>(shade_count) - position, 0.0, 1.0);
+    }
+
+    // Level of a cell from its own sample and its subsamples, if it has them. The smooth escape counts of the samples
+    // that escaped are averaged before the mean is put on the shading array, which wraps, so two samples either side
+    // of a wrap give one of their own characters rather than one from the middle. The level is then scaled by the share
+    // of samples that escaped, the others counting as blank.
+    inline double shade_level(const Sample& sample, const Subsamples& subsamples, long int max_iterations, unsigned long int shade_count, unsigned long int offset)
+    {
+        if (!subsamples.valid)
+        {
+            return shade_level(sample, max_iterations, shade_count, offset);
+        }
+        long int total = 0;
+        double smooth_total = 0.0;
+        int escaped_samples = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            const Sample point = i == 0 ? sample : subsamples[i - 1];
+            if (escaped(point, max_iterations))
+            {
+                total += point.iterations;
+                smooth_total += point.smooth;
+                escaped_samples++;
+            }
+        }
+        if (escaped_samples == 0)
+        {
+            return 0.0;
+        }
+        const Sample mean{static_cast<int32_t>(total / escaped_samples), static_cast<float>(smooth_total / escaped_samples), Outcome::Escaped};
+        return shade_level(mean, max_iterations, shade_count, offset) * escaped_samples / 4.0;
+    }
+
+    // Character of an anti-aliased cell: the one at its samples' mean level, so a cell half inside the set gets a lighter one.
+    inline char shade_char(const Sample& sample, const Subsamples& subsamples, long int max_iterations, const char* shade_chars, unsigned long int shade_count, unsigned long int offset)
+    {
+        if (!subsamples.valid)
+        {
+            return shade_char(sample, max_iterations, shade_chars, shade_count, offset);
+        }
+        return shade_chars[std::lround(shade_level(sample, subsamples, max_iterations, shade_count, offset) * (shade_count - 1))];
+    }
+
+    // Cells nearer the set than this many cell widths are inked by distance estimation, the rest are blank.
+    constexpr double distance_range = 4.0;
+
+    // Level of a distance estimated sample: 1 on the set's boundary, fading out to 0 at distance_range. Thin filaments
+    // no cell lands on still ink the cells next to them. Cells that did not escape are blank, as in the other shadings.
+    inline double distance_level(const Sample& sample, long int max_iterations)
+    {
+        if (!escaped(sample, max_iterations))
+        {
+            return 0.0;
+        }
+        return std::clamp(1.0 - sample.distance / distance_range, 0.0, 1.0);
+    }
+
+    inline char distance_char(const Sample& sample, long int max_iterations, const char* shade_chars, unsigned long int shade_count)
+    {
+        return shade_chars[std::lround(distance_level(sample, max_iterations) * (shade_count - 1))];
+    }
+
+    // Where a cell's orbit stopped, so raising the iteration limit continues it instead of starting over.
+    // For perturbation z is the delta from the reference orbit and ref_iter the reference index it is at.
+    template<typename Real>
+    struct OrbitState
+    {
+        Real zx{};
+        Real zy{};
+        int32_t ref_iter = 0;
+    };
+
+    //
+    // One T per character cell, kept in step with the view as it pans.
+    //
+    template<typename T>
+    struct Grid
+    {
+        long int width = 0;
+        long int height = 0;
+        std::vector<T> cells;
+
+        void resize(long int buffer_width, long int buffer_height)
+        {
+            width = buffer_width;
+            height = buffer_height;
+            cells.assign(width * height, T{});
+        }
+
+        void clear()
+        {
+            width = 0;
+            height = 0;
+            cells = {};
+        }
+
+        bool matches(long int buffer_width, long int buffer_height) const
+        {
+            return width == buffer_width && height == buffer_height && static_cast<long int>(cells.size()) == width * height;
+        }
+
+        // Follow a pan of dx, dy cells, see tiles::shift_cells. Exposed cells start over from T{}.
+        void shift(long int dx, long int dy)
+        {
+            if (!cells.empty())
+            {
+                tiles::shift_cells(cells, width, height, dx, dy, T{});
+            }
+        }
+
+        // Follow a zoom: cell x, y takes over the old cell at columns[x], rows[y], and starts over from T{}
+        // where either is -1. Both maps index the grid as it is, which keeps its size.
+        void remap(const std::vector<long int>& columns, const std::vector<long int>& rows)
+        {
+            if (cells.empty())
+            {
+                return;
+            }
+            const std::vector<T> old = std::move(cells);
+            cells.assign(width * height, T{});
+            for (long int y = 0; y < height; y++)
+            {
+                if (rows[y] < 0) { continue; }
+                for (long int x = 0; x < width; x++)
+                {
+                    if (columns[x] < 0) { continue; }
+                    cells[y * width + x] = old[rows[y] * width + columns[x]];
+                }
+            }
+        }
+
+        T& operator[](long int pos) { return cells[pos]; }
+        const T& operator[](long int pos) const { return cells[pos]; }
+    };
+
+    // Typed framebuffer the render stage fills and the shading pass reads.
+    using IterationBuffer = Grid<Sample>;
+
+    // Subsamples of the cells on edges, kept in step with the iteration buffer.
+    using SubsampleBuffer = Grid<Subsamples>;
+
+    // Resume state of every cell, for the arithmetic it was computed in.
+    template<typename Real>
+    using OrbitBuffer = Grid<OrbitState<Real>>;
+
+}
@@ -0,0 +1,118 @@
+#pragma once
+#include <string>
+#include <cstdint>
+
+
+namespace glyphs
+{
+
+    // What one terminal cell shows. ASCII is one sample per cell in a shading character, the others pack
+    // several samples into one cell as dots, set where the sample's shading level beats an ordered dither.
+    enum class Mode
+    {
+        ASCII,
+        HalfBlock,  // 1 by 2 samples: upper and lower half blocks.
+        Braille     // 2 by 4 samples: one Braille dot each.
+    };
+
+    inline const char* mode_name(Mode mode)
+    {
+        switch (mode)
+        {
+            case Mode::ASCII:     return "ascii";
+            case Mode::HalfBlock: return "half-block";
+            case Mode::Braille:   return "braille";
+        }
+        return "";
+    }
+
+    inline Mode next_mode(Mode mode)
+    {
+        switch (mode)
+        {
+            case Mode::ASCII:     return Mode::HalfBlock;
+            case Mode::HalfBlock: return Mode::Braille;
+            case Mode::Braille:   return Mode::ASCII;
+        }
+        return Mode::ASCII;
+    }
+
+    // Samples across and down one cell.
+    inline long int samples_across(Mode mode)
+    {
+        return mode == Mode::Braille ? 2 : 1;
+    }
+
+    inline long int samples_down(Mode mode)
+    {
+        switch (mode)
+        {
+            case Mode::ASCII:     return 1;
+            case Mode::HalfBlock: return 2;
+            case Mode::Braille:   return 4;
+        }
+        return 1;
+    }
+
+    // 4x4 Bayer matrix threshold for the sample at x, y, in (0, 1). Levels are spread into dot densities
+    // without the clumps random dithering makes.
+    inline double dither_threshold(long int x, long int y)
+    {
+        static constexpr int bayer[4][4] = {{0, 8, 2, 10}, {12, 4, 14, 6}, {3, 11, 1, 9}, {15, 7, 13, 5}};
+        return (bayer[y & 3][x & 3] + 0.5) / 16.0;
+    }
+
+    // Glyph of a cell from the dots set in it, bit dx + dy * samples_across of `dots` for the sample at dx, dy.
+    inline char32_t glyph(Mode mode, uint32_t dots)
+    {
+        switch (mode)
+        {
+            case Mode::ASCII:
+                return ' ';
+            case Mode::HalfBlock:
+            {
+                static constexpr char32_t blocks[] = {U' ', U'▀', U'▄', U'█'};
+                return blocks[dots & 3];
+            }
+            case Mode::Braille:
+            {
+                // Unicode numbers the dots down the left column, then the right, with the bottom row last.
+                static constexpr uint32_t bits[8] = {0x01, 0x08, 0x02, 0x10, 0x04, 0x20, 0x40, 0x80};
+                uint32_t pattern = 0;
+                for (int dot = 0; dot < 8; dot++)
+                {
+                    if (dots & (1u << dot)) { pattern |= bits[dot]; }
+                }
+                return U'⠀' + pattern;
+            }
+        }
+        return ' ';
+    }
+
+    inline void append_utf8(std::string& bytes, char32_t c)
+    {
+        if (c < 0x80)
+        {
+            bytes.push_back(static_cast<char>(c));
+        }
+        else if (c < 0x800)
+        {
+            bytes.push_back(static_cast<char>(0xC0 | (c >> 6)));
+            bytes.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+        }
+        else if (c < 0x10000)
+        {
+            bytes.push_back(static_cast<char>(0xE0 | (c >> 12)));
+            bytes.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3F)));
+            bytes.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+        }
+        else
+        {
+            bytes.push_back(static_cast<char>(0xF0 | (c >> 18)));
+            bytes.push_back(static_cast<char>(0x80 | ((c >> 12) & 0x3F)));
+            bytes.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3F)));
+            bytes.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+        }
+    }
+
+}
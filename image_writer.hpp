@@ -0,0 +1,181 @@
+#pragma once
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <optional>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <format>
+#include "framebuffer.hpp"
+
+
+namespace image
+{
+
+    // Files batch mode writes.
+    enum class Format
+    {
+        Raw,    // One int32 per cell, row-major in native byte order, no header: the escape iteration, or the limit for cells that never escaped.
+        PGM,    // Binary 8-bit greymap. Brightness follows the smooth escape count on a log scale, the interior is black.
+        ASCII   // One line of shading characters per row, as the terminal shows them.
+    };
+
+    // Format named on the command line.
+    inline std::optional<Format> parse_format(std::string_view name)
+    {
+        if (name == "raw")                   { return Format::Raw; }
+        if (name == "pgm")                   { return Format::PGM; }
+        if (name == "ascii" || name == "txt") { return Format::ASCII; }
+        return std::nullopt;
+    }
+
+    // Format implied by a file's extension.
+    inline std::optional<Format> format_for(std::string_view path)
+    {
+        const size_t dot = path.rfind('.');
+        if (dot == std::string_view::npos)
+        {
+            return std::nullopt;
+        }
+        return parse_format(path.substr(dot + 1));
+    }
+
+    // File of frame `index` of a numbered sequence: out.pgm becomes out_00042.pgm.
+    inline std::string frame_path(const std::string& path, long int index)
+    {
+        const size_t slash = path.rfind('/');
+        size_t dot = path.rfind('.');
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        {
+            dot = path.size();
+        }
+        return std::format("{}_{:05}{}", path.substr(0, dot), index, path.substr(dot));
+    }
+
+    // Height of a cell over its width. Terminal characters are about twice as tall as they are wide.
+    inline double cell_aspect(Format format)
+    {
+        return format == Format::ASCII ? 2.0 : 1.0;
+    }
+
+    //
+    // Writes images a band of rows at a time, so no more than one band is ever held in memory.
+    // Bands must come in order, top to bottom, each as wide as the image. Several frames written to one
+    // file follow each other, for PGM each with its own header, which makes a stream video tools can read.
+    //
+    class BandWriter
+    {
+        public:
+        BandWriter(Format format, long int max_iterations, const char* shade_chars)
+            : format(format), max_iterations(max_iterations), shade_chars(shade_chars), shade_count(std::strlen(shade_chars))
+        {
+        }
+
+        // Start writing to path, closing the last file.
+        bool open(const std::string& path)
+        {
+            file.close();
+            file.clear();
+            file.open(path, std::ios::binary);
+            return good();
+        }
+
+        // Start a frame of width by height cells.
+        void begin_frame(long int width, long int height)
+        {
+            if (format == Format::PGM)
+            {
+                file << "P5\n" << width << " " << height << "\n255\n";
+            }
+        }
+
+        bool good() const
+        {
+            return file.good();
+        }
+
+        // Subsamples, if given, are averaged into the PGM and ASCII images. Raw files keep the cells' own counts.
+        void write(const framebuffer::IterationBuffer& band, const framebuffer::SubsampleBuffer* subsamples = nullptr)
+        {
+            static const framebuffer::Subsamples none;
+            auto extra = [subsamples](long int pos) -> const framebuffer::Subsamples& { return subsamples != nullptr ? (*subsamples)[pos] : none; };
+            switch (format)
+            {
+                case Format::Raw:
+                {
+                    std::vector<int32_t> row(band.width);
+                    for (long int y = 0; y < band.height; y++)
+                    {
+                        for (long int x = 0; x < band.width; x++)
+                        {
+                            const framebuffer::Sample& sample = band[y * band.width + x];
+                            row[x] = escaped(sample) ? sample.iterations : static_cast<int32_t>(max_iterations);
+                        }
+                        file.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(int32_t));
+                    }
+                    break;
+                }
+                case Format::PGM:
+                {
+                    const double scale = 254.0 / std::log1p(static_cast<double>(max_iterations));
+                    std::vector<char> row(band.width);
+                    for (long int y = 0; y < band.height; y++)
+                    {
+                        for (long int x = 0; x < band.width; x++)
+                        {
+                            const long int pos = y * band.width + x;
+                            double level = brightness(band[pos], scale);
+                            if (extra(pos).valid)
+                            {
+                                for (int i = 0; i < 3; i++)
+                                {
+                                    level += brightness(extra(pos)[i], scale);
+                                }
+                                level /= 4.0;
+                            }
+                            row[x] = static_cast<char>(static_cast<uint8_t>(std::clamp(level, 0.0, 255.0)));
+                        }
+                        file.write(row.data(), row.size());
+                    }
+                    break;
+                }
+                case Format::ASCII:
+                {
+                    std::string line(band.width + 1, '\n');
+                    for (long int y = 0; y < band.height; y++)
+                    {
+                        for (long int x = 0; x < band.width; x++)
+                        {
+                            const long int pos = y * band.width + x;
+                            line[x] = framebuffer::shade_char(band[pos], extra(pos), max_iterations, shade_chars, shade_count, 0);
+                        }
+                        file.write(line.data(), line.size());
+                    }
+                    break;
+                }
+            }
+        }
+
+        private:
+        std::ofstream file;
+        Format format;
+        long int max_iterations;
+        const char* shade_chars;
+        unsigned long int shade_count;
+
+        bool escaped(const framebuffer::Sample& sample) const
+        {
+            return framebuffer::escaped(sample, max_iterations);
+        }
+
+        // PGM grey level of a sample.
+        double brightness(const framebuffer::Sample& sample, double scale) const
+        {
+            return escaped(sample) ? 1.0 + scale * std::log1p(std::max(0.0f, sample.smooth)) : 0.0;
+        }
+    };
+
+}
@@ -0,0 +1,168 @@
+#pragma once
+#include <array>
+#include "./mpreal.h"
+#include "precision.hpp"
+#include "framebuffer.hpp"
+
+
+namespace mpfr_kernel
+{
+    using mpfr::mpreal;
+
+    //
+    // MPFR registers for one worker's orbits. They are initialised once per thread and only re-sized when
+    // the working precision changes, every operation on them is done in place, so iterating allocates nothing.
+    //
+    struct Scratch
+    {
+        mpfr_prec_t working_precision = 0;
+
+        mpfr_t realc, imagc, zx, zy, xsqr, ysqr, sum, saved_x, saved_y, difference, tolerance, xq, q, y2;
+
+        Scratch()
+        {
+            for (mpfr_ptr reg : registers()) { mpfr_init2(reg, precision::double_bits); }
+        }
+
+        ~Scratch()
+        {
+            for (mpfr_ptr reg : registers()) { mpfr_clear(reg); }
+        }
+
+        Scratch(const Scratch&) = delete;
+        Scratch& operator=(const Scratch&) = delete;
+
+        void set_precision(mpfr_prec_t bits)
+        {
+            if (bits == working_precision)
+            {
+                return;
+            }
+            working_precision = bits;
+            for (mpfr_ptr reg : registers()) { mpfr_set_prec(reg, bits); }
+            mpfr_set_si_2exp(tolerance, 1, -(bits - precision::periodicity_slack_bits), MPFR_RNDN);
+        }
+
+        // target = origin + scale * index, the projection of a buffer index onto the plane.
+        void project(mpfr_ptr target, const mpreal& origin, const mpreal& scale, long int index)
+        {
+            mpfr_mul_si(target, scale.mpfr_srcptr(), index, MPFR_RNDN);
+            mpfr_add(target, target, origin.mpfr_srcptr(), MPFR_RNDN);
+        }
+
+        private:
+        std::array<mpfr_ptr, 14> registers()
+        {
+            return {realc, imagc, zx, zy, xsqr, ysqr, sum, saved_x, saved_y, difference, tolerance, xq, q, y2};
+        }
+    };
+
+    // The calling thread's registers.
+    inline Scratch& scratch()
+    {
+        thread_local Scratch registers;
+        return registers;
+    }
+
+    // Copy a register into a stored mpreal, which only allocates when its precision differs.
+    inline void save(mpreal& target, mpfr_srcptr source)
+    {
+        if (target.get_prec() != mpfr_get_prec(source))
+        {
+            target.set_prec(mpfr_get_prec(source));
+        }
+        mpfr_set(target.mpfr_ptr(), source, MPFR_RNDN);
+    }
+
+    // Whether realc + imagc*i lies in the main cardioid or the period 2 bulb.
+    inline bool in_cardioid_or_bulb(Scratch& s)
+    {
+        mpfr_sqr(s.y2, s.imagc, MPFR_RNDN);
+
+        // q*(q + xq) < y^2/4 with xq = x - 1/4 and q = xq^2 + y^2.
+        mpfr_sub_d(s.xq, s.realc, 0.25, MPFR_RNDN);
+        mpfr_sqr(s.q, s.xq, MPFR_RNDN);
+        mpfr_add(s.q, s.q, s.y2, MPFR_RNDN);
+        mpfr_add(s.xq, s.xq, s.q, MPFR_RNDN);
+        mpfr_mul(s.q, s.q, s.xq, MPFR_RNDN);
+        mpfr_mul_2si(s.xq, s.y2, -2, MPFR_RNDN);
+        if (mpfr_cmp(s.q, s.xq) < 0)
+        {
+            return true;
+        }
+
+        // (x + 1)^2 + y^2 < 1/16.
+        mpfr_add_si(s.xq, s.realc, 1, MPFR_RNDN);
+        mpfr_sqr(s.q, s.xq, MPFR_RNDN);
+        mpfr_add(s.q, s.q, s.y2, MPFR_RNDN);
+        return mpfr_cmp_d(s.q, 0.0625) < 0;
+    }
+
+    // Whether both components are back within the tolerance of the saved ones.
+    inline bool cycled(Scratch& s)
+    {
+        mpfr_sub(s.difference, s.zx, s.saved_x, MPFR_RNDN);
+        if (mpfr_cmpabs(s.difference, s.tolerance) >= 0)
+        {
+            return false;
+        }
+        mpfr_sub(s.difference, s.zy, s.saved_y, MPFR_RNDN);
+        return mpfr_cmpabs(s.difference, s.tolerance) < 0;
+    }
+
+    // Escape-time orbit of c = realc + imagc*i continuing from z = zx + zy*i after iter_count iterations,
+    // all taken from the registers, which are left holding where the orbit stopped. Same arithmetic, early
+    // exits and outcomes as Mandelbrot::calculate_point, so either one can continue the other's orbits.
+    inline int escape(Scratch& s, int iter_count, long int max_iterations, double& norm, framebuffer::Outcome& outcome)
+    {
+        norm = 0.0;
+        if (in_cardioid_or_bulb(s))
+        {
+            outcome = framebuffer::Outcome::Cardioid;
+            return iter_count;
+        }
+
+        mpfr_sqr(s.xsqr, s.zx, MPFR_RNDN);
+        mpfr_sqr(s.ysqr, s.zy, MPFR_RNDN);
+        mpfr_set(s.saved_x, s.zx, MPFR_RNDN);
+        mpfr_set(s.saved_y, s.zy, MPFR_RNDN);
+        long int period = 1;
+        long int steps = 0;
+
+        while (true)
+        {
+            mpfr_add(s.sum, s.xsqr, s.ysqr, MPFR_RNDN);
+            if (iter_count >= max_iterations || mpfr_cmp_si(s.sum, 4) >= 0)
+            {
+                break;
+            }
+
+            // zy = zx*zy + (zx*zy + ci), zx = zx^2 - zy^2 + cr, rounded in the same order as calculate_point.
+            mpfr_mul(s.zy, s.zy, s.zx, MPFR_RNDN);
+            mpfr_add(s.y2, s.zy, s.imagc, MPFR_RNDN);
+            mpfr_add(s.zy, s.zy, s.y2, MPFR_RNDN);
+            mpfr_sub(s.zx, s.xsqr, s.ysqr, MPFR_RNDN);
+            mpfr_add(s.zx, s.zx, s.realc, MPFR_RNDN);
+            mpfr_sqr(s.xsqr, s.zx, MPFR_RNDN);
+            mpfr_sqr(s.ysqr, s.zy, MPFR_RNDN);
+            iter_count++;
+
+            if (cycled(s))
+            {
+                outcome = framebuffer::Outcome::Periodic;
+                return iter_count;
+            }
+            if (++steps == period)
+            {
+                mpfr_set(s.saved_x, s.zx, MPFR_RNDN);
+                mpfr_set(s.saved_y, s.zy, MPFR_RNDN);
+                steps = 0;
+                period *= 2;
+            }
+        }
+        norm = mpfr_get_d(s.sum, MPFR_RNDN);
+        outcome = mpfr_cmp_si(s.sum, 4) < 0 ? framebuffer::Outcome::Bounded : framebuffer::Outcome::Escaped;
+        return iter_count;
+    }
+
+}
@@ -0,0 +1,151 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <complex>
+#include "./mpreal.h"
+
+
+namespace perturbation
+{
+    using mpfr::mpreal;
+
+    //
+    // One full precision orbit Z_n of the view center, stored as doubles.
+    // Every other pixel is iterated as a small offset from it, see Mandelbrot::calculate_perturbed.
+    //
+    struct ReferenceOrbit
+    {
+        std::vector<double> real;
+        std::vector<double> imag;
+
+        mpreal center_real;
+        mpreal center_imag;
+        long int max_iterations = -1;
+
+        // Full precision Z at the last stored index, where extend() carries on from.
+        mpreal zx;
+        mpreal zy;
+
+        // Whether the stored orbit was computed for this center, at no less than its precision.
+        bool matches(const mpreal& cr, const mpreal& ci) const
+        {
+            return center_real.get_prec() >= cr.get_prec() && center_imag.get_prec() >= ci.get_prec()
+                && center_real == cr && center_imag == ci;
+        }
+
+        // Iterate the center at the coordinates' own precision. Stops early if the center escapes,
+        // the last stored value is then the escaped one.
+        void compute(const mpreal& cr, const mpreal& ci, long int iterations)
+        {
+            center_real = cr;
+            center_imag = ci;
+            max_iterations = 0;
+
+            zx = mpreal(0, std::max(cr.get_prec(), ci.get_prec()));
+            zy = zx;
+            real.assign(1, 0.0);
+            imag.assign(1, 0.0);
+            extend(iterations);
+        }
+
+        // Continue the orbit up to a higher iteration limit. A lower one keeps what is stored.
+        void extend(long int iterations)
+        {
+            if (iterations <= max_iterations)
+            {
+                return;
+            }
+            max_iterations = iterations;
+            real.reserve(iterations + 1);
+            imag.reserve(iterations + 1);
+
+            mpreal xsqr = zx * zx;
+            mpreal ysqr = zy * zy;
+            for (long int n = last(); n < iterations && xsqr + ysqr < 4.0; n++)
+            {
+                zy *= zx;
+                zy += zy + center_imag;
+                zx = xsqr - ysqr + center_real;
+                xsqr = zx * zx;
+                ysqr = zy * zy;
+                real.push_back(zx.toDouble());
+                imag.push_back(zy.toDouble());
+            }
+        }
+
+        // Index of the last stored Z_n.
+        long int last() const
+        {
+            return static_cast<long int>(real.size()) - 1;
+        }
+    };
+
+    //
+    // Truncated power series dz_n = A_n*dc + B_n*dc^2 + C_n*dc^3 of the delta orbit in terms of the
+    // pixel offset dc. While the series holds for every dc in the viewport, all cells can start at
+    // iteration `skip` with their delta evaluated from it instead of iterating there one by one.
+    // The coefficients are kept scaled by powers of the viewport radius, a = A*r, b = B*r^2, c = C*r^3,
+    // so deep zooms don't underflow them.
+    //
+    struct SeriesApproximation
+    {
+        long int skip = 0;
+        double radius = 1.0;
+        std::complex<double> a;
+        std::complex<double> b;
+        std::complex<double> c;
+
+        // Advance the coefficients along the reference while the dropped terms stay below a thousandth of
+        // a pixel, as mapped by the linear term, for the largest offset `viewport_radius` on screen.
+        // Never skips past `max_iterations`, the reference may have been computed for a higher limit.
+        void compute(const ReferenceOrbit& reference, double viewport_radius, double pixel_spacing, long int max_iterations)
+        {
+            skip = 0;
+            radius = viewport_radius;
+            a = b = c = 0.0;
+
+            const double tolerance = 1e-3 * pixel_spacing / radius;
+            std::complex<double> an = 0.0;
+            std::complex<double> bn = 0.0;
+            std::complex<double> cn = 0.0;
+
+            const long int end = std::min(reference.last(), max_iterations);
+            for (long int n = 0; n + 1 < end; n++)
+            {
+                const std::complex<double> z2 = 2.0 * std::complex<double>{reference.real[n], reference.imag[n]};
+                const std::complex<double> an_next = z2 * an + radius;
+                const std::complex<double> bn_next = z2 * bn + an * an;
+                const std::complex<double> cn_next = z2 * cn + 2.0 * an * bn;
+                an = an_next;
+                bn = bn_next;
+                cn = cn_next;
+
+                // Truncation error estimate against the pixel size mapped through the linear term.
+                if (!(std::abs(cn) <= tolerance * std::abs(an)))
+                {
+                    break;
+                }
+
+                // The skipped deltas must stay small against the orbit, or cells would have needed a rebase.
+                const double delta = std::abs(an) + std::abs(bn);
+                if (!(delta <= 1e-3 * std::abs(std::complex<double>{reference.real[n + 1], reference.imag[n + 1]})))
+                {
+                    break;
+                }
+
+                skip = n + 1;
+                a = an;
+                b = bn;
+                c = cn;
+            }
+        }
+
+        // Delta at iteration `skip` for the pixel offset dc.
+        std::complex<double> evaluate(double dcr, double dci) const
+        {
+            const std::complex<double> u = std::complex<double>{dcr, dci} / radius;
+            return ((c * u + b) * u + a) * u;
+        }
+    };
+
+}
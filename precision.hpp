@@ -0,0 +1,291 @@
+#pragma once
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <type_traits>
+#include <limits>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include "./mpreal.h"
+
+
+namespace precision
+{
+    using mpfr::mpreal;
+
+    // Arithmetic backends, cheapest first. Auto picks the cheapest one that still resolves a pixel.
+    enum class Backend
+    {
+        Auto,
+        Double,
+        LongDouble,
+        DoubleDouble,
+        Perturbation,
+        MPFR
+    };
+
+    inline const char* backend_name(Backend backend)
+    {
+        switch (backend)
+        {
+            case Backend::Auto:         return "auto";
+            case Backend::Double:       return "double";
+            case Backend::LongDouble:   return "long double";
+            case Backend::DoubleDouble: return "double-double";
+            case Backend::Perturbation: return "perturbation";
+            case Backend::MPFR:         return "mpfr";
+        }
+        return "";
+    }
+
+    // Next backend in the user selectable cycle.
+    inline Backend next_backend(Backend backend)
+    {
+        switch (backend)
+        {
+            case Backend::Auto:         return Backend::Double;
+            case Backend::Double:       return Backend::LongDouble;
+            case Backend::LongDouble:   return Backend::DoubleDouble;
+            case Backend::DoubleDouble: return Backend::Perturbation;
+            case Backend::Perturbation: return Backend::MPFR;
+            case Backend::MPFR:         return Backend::Auto;
+        }
+        return Backend::Auto;
+    }
+
+    // Backend named by a command line argument: its backend_name, with '-' standing in for spaces.
+    inline std::optional<Backend> parse_backend(std::string_view name)
+    {
+        Backend backend = Backend::Auto;
+        do
+        {
+            std::string expected = backend_name(backend);
+            std::replace(expected.begin(), expected.end(), ' ', '-');
+            if (name == expected || name == backend_name(backend))
+            {
+                return backend;
+            }
+            backend = next_backend(backend);
+        }
+        while (backend != Backend::Auto);
+        return std::nullopt;
+    }
+
+    //
+    // Double-double: an unevaluated sum hi + lo of two doubles, ~106 bits of significand.
+    // Relies on exact IEEE rounding, so it must not be compiled with -ffast-math.
+    //
+    struct dd_real
+    {
+        double hi = 0.0;
+        double lo = 0.0;
+
+        dd_real() = default;
+        dd_real(double hi): hi{hi} {}
+        dd_real(double hi, double lo): hi{hi}, lo{lo} {}
+
+        // Split an mpreal into its two nearest doubles.
+        explicit
+        dd_real(const mpreal& value)
+        {
+            hi = value.toDouble();
+            lo = (value - hi).toDouble();
+        }
+
+        static dd_real quick_two_sum(double a, double b)
+        {
+            const double s = a + b;
+            return {s, b - (s - a)};
+        }
+
+        static dd_real two_sum(double a, double b)
+        {
+            const double s = a + b;
+            const double bb = s - a;
+            return {s, (a - (s - bb)) + (b - bb)};
+        }
+
+        static dd_real two_prod(double a, double b)
+        {
+            const double p = a * b;
+            return {p, std::fma(a, b, -p)};
+        }
+
+        friend dd_real operator+(const dd_real& a, const dd_real& b)
+        {
+            dd_real s = two_sum(a.hi, b.hi);
+            const dd_real t = two_sum(a.lo, b.lo);
+            s.lo += t.hi;
+            s = quick_two_sum(s.hi, s.lo);
+            s.lo += t.lo;
+            return quick_two_sum(s.hi, s.lo);
+        }
+
+        friend dd_real operator-(const dd_real& a, const dd_real& b)
+        {
+            return a + dd_real{-b.hi, -b.lo};
+        }
+
+        friend dd_real operator*(const dd_real& a, const dd_real& b)
+        {
+            dd_real p = two_prod(a.hi, b.hi);
+            p.lo += a.hi * b.lo + a.lo * b.hi;
+            return quick_two_sum(p.hi, p.lo);
+        }
+
+        friend dd_real operator*(const dd_real& a, double b)
+        {
+            dd_real p = two_prod(a.hi, b);
+            p.lo += a.lo * b;
+            return quick_two_sum(p.hi, p.lo);
+        }
+
+        friend bool operator<(const dd_real& a, double b)
+        {
+            return a.hi < b || (a.hi == b && a.lo < 0.0);
+        }
+
+        dd_real& operator+=(const dd_real& v) { return *this = *this + v; }
+        dd_real& operator-=(const dd_real& v) { return *this = *this - v; }
+        dd_real& operator*=(const dd_real& v) { return *this = *this * v; }
+    };
+
+    // Convert a view coordinate into the backend's arithmetic type.
+    template<typename Real>
+    Real from_mpreal(const mpreal& value)
+    {
+        if constexpr (std::is_same_v<Real, double>) { return value.toDouble(); }
+        else if constexpr (std::is_same_v<Real, long double>) { return value.toLDouble(); }
+        else if constexpr (std::is_same_v<Real, dd_real>) { return dd_real{value}; }
+        else { return value; }
+    }
+
+    // Nearest double, for values that only feed shading.
+    inline double to_double(double value) { return value; }
+    inline double to_double(long double value) { return static_cast<double>(value); }
+    inline double to_double(const dd_real& value) { return value.hi; }
+    inline double to_double(const mpreal& value) { return value.toDouble(); }
+
+    // Extra units in the last place that two orbit values may differ by and still count as the same point of a cycle.
+    inline constexpr int periodicity_slack_bits = 4;
+
+    // Distance below which a cycling orbit is taken to be back at an earlier value, for values around 1.
+    template<typename Real>
+    Real periodicity_tolerance(const Real& like)
+    {
+        if constexpr (std::is_same_v<Real, mpreal>)
+        {
+            mpreal tolerance(1, like.get_prec());
+            mpfr_mul_2si(tolerance.mpfr_ptr(), tolerance.mpfr_srcptr(), -(like.get_prec() - periodicity_slack_bits), MPFR_RNDN);
+            return tolerance;
+        }
+        else if constexpr (std::is_same_v<Real, dd_real>) { return dd_real{std::ldexp(1.0, -(2 * DBL_MANT_DIG - 2 - periodicity_slack_bits))}; }
+        else { return std::ldexp(Real{1}, -(std::numeric_limits<Real>::digits - periodicity_slack_bits)); }
+    }
+
+    // |a - b| < tolerance, in the backend's own arithmetic.
+    inline bool within(double a, double b, double tolerance) { return std::abs(a - b) < tolerance; }
+    inline bool within(long double a, long double b, long double tolerance) { return std::abs(a - b) < tolerance; }
+    inline bool within(const dd_real& a, const dd_real& b, const dd_real& tolerance) { return std::abs((a - b).hi) < tolerance.hi; }
+    inline bool within(const mpreal& a, const mpreal& b, const mpreal& tolerance)
+    {
+        // The orbit loop asks every iteration, so the difference goes into a per thread scratch value.
+        thread_local mpreal difference;
+        if (difference.get_prec() != a.get_prec())
+        {
+            difference.set_prec(a.get_prec());
+        }
+        mpfr_sub(difference.mpfr_ptr(), a.mpfr_srcptr(), b.mpfr_srcptr(), MPFR_RNDN);
+        return mpfr_cmpabs(difference.mpfr_srcptr(), tolerance.mpfr_srcptr()) < 0;
+    }
+
+    // A zero carrying the same precision as the given value, so MPFR orbits never fall back to the default precision.
+    template<typename Real>
+    Real zero_like(const Real& value)
+    {
+        if constexpr (std::is_same_v<Real, mpreal>) { return mpreal(0, value.get_prec()); }
+        else { return Real{0.0}; }
+    }
+
+    // Bits of significand a backend can spend on resolving pixels.
+    inline constexpr int double_bits      = DBL_MANT_DIG;
+    inline constexpr int long_double_bits = LDBL_MANT_DIG;
+    inline constexpr int dd_bits          = 2 * DBL_MANT_DIG - 2;
+
+    // Headroom for rounding error accumulated along the orbit.
+    inline constexpr int guard_bits = 10;
+
+    // Smallest pixel spacing (as a power of two) whose deltas still fit in a normal double.
+    inline constexpr int min_delta_exponent = DBL_MIN_EXP + 64;
+
+    // Bits needed to tell two neighbouring pixels apart, given the largest coordinate magnitude on screen.
+    inline int required_bits(const mpreal& pixel_spacing, const mpreal& magnitude)
+    {
+        const mpreal ratio = std::max(magnitude, mpreal(1)) / pixel_spacing;
+        return static_cast<int>(std::ceil(mpfr::log2(ratio).toDouble())) + guard_bits;
+    }
+
+    // Precision to parse a typed decimal at, so none of its digits are lost.
+    inline mpfr_prec_t parse_bits(const char* text)
+    {
+        return std::max<mpfr_prec_t>(double_bits, mpfr::digits2bits(static_cast<int>(std::strlen(text))) + guard_bits);
+    }
+
+    // Binary exponent of a value, floor(log2(|value|)).
+    inline int exponent_of(const mpreal& value)
+    {
+        return static_cast<int>(std::floor(mpfr::log2(abs(value)).toDouble()));
+    }
+
+    // Cheapest backend that can resolve the required bits. Past the hardware types, perturbation iterates
+    // at double speed for as long as the pixel deltas fit in a double, so double-double is only used when forced.
+    inline Backend select_backend(int bits, int spacing_exponent)
+    {
+        if (bits <= double_bits) { return Backend::Double; }
+        if (long_double_bits > double_bits && bits <= long_double_bits) { return Backend::LongDouble; }
+        if (spacing_exponent > min_delta_exponent) { return Backend::Perturbation; }
+        return Backend::MPFR;
+    }
+
+    // Bits of significand the cells are actually iterated with. Perturbation iterates double deltas, MPFR runs at
+    // the view's working precision, which never drops below a double's.
+    inline int working_bits(Backend backend, int required)
+    {
+        switch (backend)
+        {
+            case Backend::Auto:
+            case Backend::Double:
+            case Backend::Perturbation: return double_bits;
+            case Backend::LongDouble:   return long_double_bits;
+            case Backend::DoubleDouble: return dd_bits;
+            case Backend::MPFR:         return std::max(double_bits, required);
+        }
+        return double_bits;
+    }
+
+    //
+    // Projection of the character buffer onto the plane, converted once per frame into the backend's type.
+    //
+    template<typename Real>
+    struct Viewport
+    {
+        Real real_min;
+        Real imag_min;
+        Real width_scale;
+        Real height_scale;
+
+        Viewport(const mpreal& real_min, const mpreal& imag_min, const mpreal& width_scale, const mpreal& height_scale):
+            real_min{from_mpreal<Real>(real_min)},
+            imag_min{from_mpreal<Real>(imag_min)},
+            width_scale{from_mpreal<Real>(width_scale)},
+            height_scale{from_mpreal<Real>(height_scale)}
+        {
+        }
+
+        Real real_at(long int x) const { return real_min + width_scale * static_cast<double>(x); }
+        Real imag_at(long int y) const { return imag_min + height_scale * static_cast<double>(y); }
+    };
+
+}
@@ -0,0 +1,312 @@
+#pragma once
+#include <immintrin.h>
+#include <algorithm>
+#include "precision.hpp"
+#include "framebuffer.hpp"
+
+
+namespace simd
+{
+
+    // Escape-time iteration for `count` points that share one imaginary coordinate, i.e. a run of a buffer row.
+    // All points continue from `start_iterations` with the z they are given, zero for fresh points.
+    // Writes each point's iteration count and its |z|^2 when it escaped (the last one, if it did not).
+    // Points that did not escape get back the z they stopped at, for escaped ones it is left undefined.
+    // Points in the main cardioid or period 2 bulb are not iterated, and orbits caught cycling by Brent's
+    // method stop early, both with their outcome set accordingly.
+    // Every kernel follows the scalar orbit in Mandelbrot::calculate_point operation for operation,
+    // so all of them produce identical results.
+    using RowKernel = void (*)(const double* realc, double imagc, int count, long int start_iterations, long int max_iterations,
+                               int* iterations, double* zx, double* zy, double* norms, framebuffer::Outcome* outcomes);
+
+    inline void escape_row_scalar(const double* realc, double imagc, int count, long int start_iterations, long int max_iterations,
+                                  int* iterations, double* zx, double* zy, double* norms, framebuffer::Outcome* outcomes)
+    {
+        const double tolerance = precision::periodicity_tolerance(0.0);
+        const double y2 = imagc * imagc;
+        for (int i = 0; i < count; i++)
+        {
+            const double xq = realc[i] - 0.25;
+            const double q = xq * xq + y2;
+            const double xb = realc[i] + 1.0;
+            if (q * (q + xq) - y2 * 0.25 < 0.0 || xb * xb + y2 - 0.0625 < 0.0)
+            {
+                iterations[i] = start_iterations;
+                norms[i] = 0.0;
+                outcomes[i] = framebuffer::Outcome::Cardioid;
+                continue;
+            }
+
+            int iter_count = start_iterations;
+            double x = zx[i], y = zy[i], xsqr = x * x, ysqr = y * y;
+            double saved_x = x, saved_y = y;
+            long int period = 1, steps = 0;
+            bool periodic = false;
+            while (iter_count < max_iterations && xsqr + ysqr < 4.0)
+            {
+                y *= x;
+                y += y + imagc;
+                x = xsqr - ysqr + realc[i];
+                xsqr = x * x;
+                ysqr = y * y;
+                iter_count++;
+
+                if (std::abs(x - saved_x) < tolerance && std::abs(y - saved_y) < tolerance)
+                {
+                    periodic = true;
+                    break;
+                }
+                if (++steps == period)
+                {
+                    saved_x = x;
+                    saved_y = y;
+                    steps = 0;
+                    period *= 2;
+                }
+            }
+            iterations[i] = iter_count;
+            zx[i] = x;
+            zy[i] = y;
+            norms[i] = periodic ? 0.0 : xsqr + ysqr;
+            outcomes[i] = periodic ? framebuffer::Outcome::Periodic
+                        : xsqr + ysqr < 4.0 ? framebuffer::Outcome::Bounded : framebuffer::Outcome::Escaped;
+        }
+    }
+
+    // 4 lanes. Escaped, interior and cycling lanes keep iterating but are masked out of the count,
+    // the batch stops once no lane is left.
+    __attribute__((target("avx2")))
+    inline void escape_row_avx2(const double* realc, double imagc, int count, long int start_iterations, long int max_iterations,
+                                int* iterations, double* zx, double* zy, double* norms, framebuffer::Outcome* outcomes)
+    {
+        constexpr int lanes = 4;
+        const __m256d four = _mm256_set1_pd(4.0);
+        const __m256d one = _mm256_set1_pd(1.0);
+        const __m256d zero = _mm256_setzero_pd();
+        const __m256d ci = _mm256_set1_pd(imagc);
+        const __m256d y2 = _mm256_set1_pd(imagc * imagc);
+        const __m256d sign = _mm256_set1_pd(-0.0);
+        const __m256d tolerance = _mm256_set1_pd(precision::periodicity_tolerance(0.0));
+
+        for (int i = 0; i < count; i += lanes)
+        {
+            // Pad a short tail with the last point, its results are dropped.
+            alignas(32) double cr_lanes[lanes];
+            alignas(32) double zx_lanes[lanes];
+            alignas(32) double zy_lanes[lanes];
+            for (int l = 0; l < lanes; l++)
+            {
+                const int source = std::min(i + l, count - 1);
+                cr_lanes[l] = realc[source];
+                zx_lanes[l] = zx[source];
+                zy_lanes[l] = zy[source];
+            }
+
+            const __m256d cr = _mm256_load_pd(cr_lanes);
+            __m256d x = _mm256_load_pd(zx_lanes), y = _mm256_load_pd(zy_lanes), xsqr = _mm256_mul_pd(x, x), ysqr = _mm256_mul_pd(y, y);
+            __m256d counts = _mm256_set1_pd(static_cast<double>(start_iterations)), norm = _mm256_setzero_pd();
+
+            // Main cardioid and period 2 bulb.
+            const __m256d xq = _mm256_sub_pd(cr, _mm256_set1_pd(0.25));
+            const __m256d q = _mm256_add_pd(_mm256_mul_pd(xq, xq), y2);
+            const __m256d xb = _mm256_add_pd(cr, one);
+            const __m256d cardioid = _mm256_cmp_pd(_mm256_sub_pd(_mm256_mul_pd(q, _mm256_add_pd(q, xq)), _mm256_mul_pd(y2, _mm256_set1_pd(0.25))), zero, _CMP_LT_OQ);
+            const __m256d bulb = _mm256_cmp_pd(_mm256_sub_pd(_mm256_add_pd(_mm256_mul_pd(xb, xb), y2), _mm256_set1_pd(0.0625)), zero, _CMP_LT_OQ);
+            const __m256d inside = _mm256_or_pd(cardioid, bulb);
+            __m256d active = _mm256_andnot_pd(inside, _mm256_castsi256_pd(_mm256_set1_epi64x(-1)));
+
+            __m256d saved_x = x, saved_y = y, periodic = zero;
+            long int period = 1, steps = 0;
+
+            for (long int n = start_iterations; n < max_iterations; n++)
+            {
+                const __m256d sum = _mm256_add_pd(xsqr, ysqr);
+                norm = _mm256_blendv_pd(norm, sum, active);
+                active = _mm256_and_pd(active, _mm256_cmp_pd(sum, four, _CMP_LT_OQ));
+                if (_mm256_movemask_pd(active) == 0)
+                {
+                    break;
+                }
+                counts = _mm256_add_pd(counts, _mm256_and_pd(active, one));
+
+                y = _mm256_mul_pd(y, x);
+                y = _mm256_add_pd(y, _mm256_add_pd(y, ci));
+                x = _mm256_add_pd(_mm256_sub_pd(xsqr, ysqr), cr);
+                xsqr = _mm256_mul_pd(x, x);
+                ysqr = _mm256_mul_pd(y, y);
+
+                const __m256d near_x = _mm256_cmp_pd(_mm256_andnot_pd(sign, _mm256_sub_pd(x, saved_x)), tolerance, _CMP_LT_OQ);
+                const __m256d near_y = _mm256_cmp_pd(_mm256_andnot_pd(sign, _mm256_sub_pd(y, saved_y)), tolerance, _CMP_LT_OQ);
+                const __m256d cycled = _mm256_and_pd(active, _mm256_and_pd(near_x, near_y));
+                periodic = _mm256_or_pd(periodic, cycled);
+                active = _mm256_andnot_pd(cycled, active);
+                if (++steps == period)
+                {
+                    saved_x = x;
+                    saved_y = y;
+                    steps = 0;
+                    period *= 2;
+                }
+            }
+            norm = _mm256_blendv_pd(norm, _mm256_add_pd(xsqr, ysqr), active);
+
+            alignas(32) double count_lanes[lanes];
+            alignas(32) double norm_lanes[lanes];
+            _mm256_store_pd(count_lanes, counts);
+            _mm256_store_pd(norm_lanes, _mm256_andnot_pd(periodic, norm));
+            _mm256_store_pd(zx_lanes, x);
+            _mm256_store_pd(zy_lanes, y);
+            const int inside_lanes = _mm256_movemask_pd(inside);
+            const int periodic_lanes = _mm256_movemask_pd(periodic);
+            for (int l = 0; l < lanes && i + l < count; l++)
+            {
+                iterations[i + l] = static_cast<int>(count_lanes[l]);
+                zx[i + l] = zx_lanes[l];
+                zy[i + l] = zy_lanes[l];
+                norms[i + l] = norm_lanes[l];
+                outcomes[i + l] = (inside_lanes >> l) & 1 ? framebuffer::Outcome::Cardioid
+                                : (periodic_lanes >> l) & 1 ? framebuffer::Outcome::Periodic
+                                : norm_lanes[l] < 4.0 ? framebuffer::Outcome::Bounded : framebuffer::Outcome::Escaped;
+            }
+        }
+    }
+
+    // 8 lanes with AVX-512 mask registers. The explicitly rounded multiplies keep the compiler from
+    // fusing them into FMAs, which would round differently from the other kernels.
+    __attribute__((target("avx512f")))
+    inline void escape_row_avx512(const double* realc, double imagc, int count, long int start_iterations, long int max_iterations,
+                                  int* iterations, double* zx, double* zy, double* norms, framebuffer::Outcome* outcomes)
+    {
+        constexpr int lanes = 8;
+        constexpr int rounding = _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC;
+        const __m512d four = _mm512_set1_pd(4.0);
+        const __m512d one = _mm512_set1_pd(1.0);
+        const __m512d zero = _mm512_setzero_pd();
+        const __m512d ci = _mm512_set1_pd(imagc);
+        const __m512d y2 = _mm512_set1_pd(imagc * imagc);
+        const __m512d tolerance = _mm512_set1_pd(precision::periodicity_tolerance(0.0));
+
+        for (int i = 0; i < count; i += lanes)
+        {
+            alignas(64) double cr_lanes[lanes];
+            alignas(64) double zx_lanes[lanes];
+            alignas(64) double zy_lanes[lanes];
+            for (int l = 0; l < lanes; l++)
+            {
+                const int source = std::min(i + l, count - 1);
+                cr_lanes[l] = realc[source];
+                zx_lanes[l] = zx[source];
+                zy_lanes[l] = zy[source];
+            }
+
+            const __m512d cr = _mm512_load_pd(cr_lanes);
+            __m512d x = _mm512_load_pd(zx_lanes), y = _mm512_load_pd(zy_lanes);
+            __m512d xsqr = _mm512_maskz_mul_round_pd(0xFF, x, x, rounding), ysqr = _mm512_maskz_mul_round_pd(0xFF, y, y, rounding);
+            __m512d counts = _mm512_set1_pd(static_cast<double>(start_iterations)), norm = _mm512_setzero_pd();
+
+            // Main cardioid and period 2 bulb.
+            const __m512d xq = _mm512_sub_pd(cr, _mm512_set1_pd(0.25));
+            const __m512d q = _mm512_add_pd(_mm512_maskz_mul_round_pd(0xFF, xq, xq, rounding), y2);
+            const __m512d xb = _mm512_add_pd(cr, one);
+            const __m512d cardioid_term = _mm512_sub_pd(_mm512_maskz_mul_round_pd(0xFF, q, _mm512_add_pd(q, xq), rounding),
+                                                        _mm512_maskz_mul_round_pd(0xFF, y2, _mm512_set1_pd(0.25), rounding));
+            const __m512d bulb_term = _mm512_sub_pd(_mm512_add_pd(_mm512_maskz_mul_round_pd(0xFF, xb, xb, rounding), y2), _mm512_set1_pd(0.0625));
+            const __mmask8 inside = _mm512_cmp_pd_mask(cardioid_term, zero, _CMP_LT_OQ) | _mm512_cmp_pd_mask(bulb_term, zero, _CMP_LT_OQ);
+            __mmask8 active = ~inside;
+
+            __m512d saved_x = x, saved_y = y;
+            __mmask8 periodic = 0;
+            long int period = 1, steps = 0;
+
+            for (long int n = start_iterations; n < max_iterations; n++)
+            {
+                const __m512d sum = _mm512_add_pd(xsqr, ysqr);
+                norm = _mm512_mask_mov_pd(norm, active, sum);
+                active = _mm512_mask_cmp_pd_mask(active, sum, four, _CMP_LT_OQ);
+                if (active == 0)
+                {
+                    break;
+                }
+                counts = _mm512_mask_add_pd(counts, active, counts, one);
+
+                y = _mm512_maskz_mul_round_pd(0xFF, y, x, rounding);
+                y = _mm512_add_pd(y, _mm512_add_pd(y, ci));
+                x = _mm512_add_pd(_mm512_sub_pd(xsqr, ysqr), cr);
+                xsqr = _mm512_maskz_mul_round_pd(0xFF, x, x, rounding);
+                ysqr = _mm512_maskz_mul_round_pd(0xFF, y, y, rounding);
+
+                const __mmask8 near_x = _mm512_mask_cmp_pd_mask(active, _mm512_abs_pd(_mm512_sub_pd(x, saved_x)), tolerance, _CMP_LT_OQ);
+                const __mmask8 cycled = _mm512_mask_cmp_pd_mask(near_x, _mm512_abs_pd(_mm512_sub_pd(y, saved_y)), tolerance, _CMP_LT_OQ);
+                periodic |= cycled;
+                active &= ~cycled;
+                if (++steps == period)
+                {
+                    saved_x = x;
+                    saved_y = y;
+                    steps = 0;
+                    period *= 2;
+                }
+            }
+            norm = _mm512_mask_mov_pd(norm, active, _mm512_add_pd(xsqr, ysqr));
+
+            alignas(64) double count_lanes[lanes];
+            alignas(64) double norm_lanes[lanes];
+            _mm512_store_pd(count_lanes, counts);
+            _mm512_store_pd(norm_lanes, _mm512_maskz_mov_pd(~periodic, norm));
+            _mm512_store_pd(zx_lanes, x);
+            _mm512_store_pd(zy_lanes, y);
+            for (int l = 0; l < lanes && i + l < count; l++)
+            {
+                iterations[i + l] = static_cast<int>(count_lanes[l]);
+                zx[i + l] = zx_lanes[l];
+                zy[i + l] = zy_lanes[l];
+                norms[i + l] = norm_lanes[l];
+                outcomes[i + l] = (inside >> l) & 1 ? framebuffer::Outcome::Cardioid
+                                : (periodic >> l) & 1 ? framebuffer::Outcome::Periodic
+                                : norm_lanes[l] < 4.0 ? framebuffer::Outcome::Bounded : framebuffer::Outcome::Escaped;
+            }
+        }
+    }
+
+    // Instruction sets a kernel can be forced to, Best picks the widest one this CPU supports.
+    enum class ISA
+    {
+        Best,
+        Scalar,
+        AVX2,
+        AVX512
+    };
+
+    inline ISA detect()
+    {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) { return ISA::AVX512; }
+        if (__builtin_cpu_supports("avx2")) { return ISA::AVX2; }
+        return ISA::Scalar;
+    }
+
+    inline const char* isa_name(ISA isa)
+    {
+        switch (isa)
+        {
+            case ISA::Best:   return "best";
+            case ISA::Scalar: return "scalar";
+            case ISA::AVX2:   return "avx2";
+            case ISA::AVX512: return "avx512";
+        }
+        return "";
+    }
+
+    inline RowKernel kernel_for(ISA isa)
+    {
+        switch (isa)
+        {
+            case ISA::Best:   return kernel_for(detect());
+            case ISA::Scalar: return escape_row_scalar;
+            case ISA::AVX2:   return escape_row_avx2;
+            case ISA::AVX512: return escape_row_avx512;
+        }
+        return escape_row_scalar;
+    }
+
+}
@@ -0,0 +1,113 @@
+// Checks the double-double arithmetic against MPFR: two_sum and two_prod must be exact, and the split of an mpreal,
+// sums, differences, products and squares must agree with the result rounded to 106 bits to within a few units
+// in its last place.
+#include <iostream>
+#include <format>
+#include <random>
+#include <vector>
+#include <cmath>
+#include "../precision.hpp"
+
+
+namespace
+{
+    using mpfr::mpreal;
+    using precision::dd_real;
+
+    // Wide enough to hold hi + lo of any double-double below exactly.
+    constexpr mpfr_prec_t exact_bits = 512;
+
+    // Relative error allowed against the exact result, a few units in the last place of a 106 bit significand.
+    const double tolerance = std::ldexp(1.0, -102);
+
+    long int failures = 0;
+
+    mpreal exact(const dd_real& value)
+    {
+        mpreal sum(value.hi, exact_bits);
+        mpfr_add_d(sum.mpfr_ptr(), sum.mpfr_srcptr(), value.lo, MPFR_RNDN);
+        return sum;
+    }
+
+    mpreal exact(double value)
+    {
+        return mpreal(value, exact_bits);
+    }
+
+    void check(bool passed, const std::string& what)
+    {
+        if (!passed)
+        {
+            if (failures < 10)
+            {
+                std::cerr << what << "\n";
+            }
+            failures++;
+        }
+    }
+
+    // Whether a double-double is normalised: lo is at most half a unit in the last place of hi.
+    bool normalised(const dd_real& value)
+    {
+        return value.hi + value.lo == value.hi;
+    }
+
+    // |got - want| <= tolerance * |want|, with want the exact result rounded to 106 bits as MPFR would.
+    void check_close(const dd_real& got, const mpreal& exact_result, const std::string& what)
+    {
+        const mpreal want(exact_result, precision::dd_bits + 2);
+        const mpreal error = abs(exact(got) - want);
+        const bool passed = normalised(got) && error <= abs(want) * tolerance;
+        check(passed, std::format("{}: got {:.17g} {:+.17g}, want {}, error {}", what, got.hi, got.lo, want.toString(40), error.toString(5)));
+    }
+
+    // Random double-double with a significand of the full 106 bits and an exponent in [-exponent_range, exponent_range].
+    dd_real random_dd(std::mt19937_64& random, int exponent_range)
+    {
+        std::uniform_real_distribution<double> significand(-1.0, 1.0);
+        std::uniform_int_distribution<int> exponent(-exponent_range, exponent_range);
+        const double hi = std::ldexp(significand(random), exponent(random));
+        const double lo = std::ldexp(hi * significand(random), -53);
+        return dd_real::quick_two_sum(hi, lo);
+    }
+
+}
+
+int main()
+{
+    std::mt19937_64 random(20260101);
+    const int count = 100000;
+
+    for (int i = 0; i < count; i++)
+    {
+        const dd_real a = random_dd(random, 8);
+        const dd_real b = random_dd(random, 8);
+
+        const dd_real sum = dd_real::two_sum(a.hi, b.hi);
+        check(sum.hi == a.hi + b.hi && exact(sum) == exact(a.hi) + exact(b.hi),
+              std::format("two_sum({:.17g}, {:.17g}) = {:.17g} {:+.17g} is not exact", a.hi, b.hi, sum.hi, sum.lo));
+
+        const dd_real product = dd_real::two_prod(a.hi, b.hi);
+        check(product.hi == a.hi * b.hi && exact(product) == exact(a.hi) * exact(b.hi),
+              std::format("two_prod({:.17g}, {:.17g}) = {:.17g} {:+.17g} is not exact", a.hi, b.hi, product.hi, product.lo));
+
+        const std::string operands = std::format("{:.17g} {:+.17g}, {:.17g} {:+.17g}", a.hi, a.lo, b.hi, b.lo);
+        check_close(a + b, exact(a) + exact(b), "add " + operands);
+        check_close(a - b, exact(a) - exact(b), "sub " + operands);
+        check_close(a * b, exact(a) * exact(b), "mul " + operands);
+        check_close(a * b.hi, exact(a) * exact(b.hi), "mul double " + operands);
+        check_close(a * a, exact(a) * exact(a), "sqr " + operands);
+
+        // Nearly cancelling operands, where a sum of two doubles alone would keep no correct bits.
+        const dd_real c = dd_real{-a.hi, std::ldexp(a.lo, -(i % 40))};
+        check_close(a + c, exact(a) + exact(c), "cancelling add " + operands);
+
+        // An mpreal with more bits than a double-double holds splits into one within those few units.
+        mpreal value(0, exact_bits);
+        mpfr_mul_d(value.mpfr_ptr(), exact(a).mpfr_srcptr(), 1.0 + std::ldexp(1.0, -60), MPFR_RNDN);
+        check_close(dd_real{value}, value, "split " + operands);
+    }
+
+    std::cout << std::format("{} cases, {} failures\n", count, failures);
+    return failures == 0 ? 0 : 1;
+}
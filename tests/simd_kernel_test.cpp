@@ -0,0 +1,186 @@
+// Checks that every row kernel this CPU runs gives the same counts, outcomes, |z|^2 and orbits as the scalar
+// Mandelbrot::calculate_point<double>, for fresh points and for batches continued from a stored orbit after
+// a raised iteration limit.
+#define ASCIIMANDELBROT_NO_MAIN
+#include "../asciimandelbrot.cpp"
+
+
+namespace
+{
+
+    struct Point
+    {
+        int iterations = 0;
+        framebuffer::Outcome outcome = framebuffer::Outcome::Bounded;
+        double norm = 0.0;
+        double zx = 0.0;
+        double zy = 0.0;
+    };
+
+    // A row of points, first to `first_limit` iterations, then the ones still bounded continued to `max_iterations`.
+    std::vector<Point> scalar_row(Mandelbrot& mandelbrot, const std::vector<double>& realc, double imagc, long int first_limit, long int max_iterations)
+    {
+        std::vector<Point> points(realc.size());
+        for (size_t i = 0; i < realc.size(); i++)
+        {
+            framebuffer::OrbitState<double> orbit;
+            Point& point = points[i];
+            point.iterations = mandelbrot.calculate_point(realc[i], imagc, orbit, 0, first_limit, point.norm, point.outcome);
+            if (point.outcome == framebuffer::Outcome::Bounded)
+            {
+                point.iterations = mandelbrot.calculate_point(realc[i], imagc, orbit, point.iterations, max_iterations, point.norm, point.outcome);
+            }
+            point.zx = orbit.zx;
+            point.zy = orbit.zy;
+        }
+        return points;
+    }
+
+    std::vector<Point> kernel_row(simd::RowKernel kernel, const std::vector<double>& realc, double imagc, long int first_limit, long int max_iterations)
+    {
+        const int count = realc.size();
+        std::vector<int> iterations(count);
+        std::vector<double> zx(count, 0.0), zy(count, 0.0), norms(count);
+        std::vector<framebuffer::Outcome> outcomes(count);
+        kernel(realc.data(), imagc, count, 0, max_iterations < first_limit ? max_iterations : first_limit,
+               iterations.data(), zx.data(), zy.data(), norms.data(), outcomes.data());
+
+        // The engine continues the cells a batch left bounded as one batch of their own, from their stored z.
+        std::vector<int> resumed;
+        for (int i = 0; i < count; i++)
+        {
+            if (outcomes[i] == framebuffer::Outcome::Bounded)
+            {
+                resumed.push_back(i);
+            }
+        }
+        const int resumed_count = resumed.size();
+        std::vector<double> resumed_realc(resumed_count), resumed_zx(resumed_count), resumed_zy(resumed_count), resumed_norms(resumed_count);
+        std::vector<int> resumed_iterations(resumed_count);
+        std::vector<framebuffer::Outcome> resumed_outcomes(resumed_count);
+        for (int j = 0; j < resumed_count; j++)
+        {
+            resumed_realc[j] = realc[resumed[j]];
+            resumed_zx[j] = zx[resumed[j]];
+            resumed_zy[j] = zy[resumed[j]];
+        }
+        if (resumed_count > 0)
+        {
+            kernel(resumed_realc.data(), imagc, resumed_count, first_limit, max_iterations,
+                   resumed_iterations.data(), resumed_zx.data(), resumed_zy.data(), resumed_norms.data(), resumed_outcomes.data());
+        }
+        for (int j = 0; j < resumed_count; j++)
+        {
+            const int i = resumed[j];
+            iterations[i] = resumed_iterations[j];
+            zx[i] = resumed_zx[j];
+            zy[i] = resumed_zy[j];
+            norms[i] = resumed_norms[j];
+            outcomes[i] = resumed_outcomes[j];
+        }
+
+        std::vector<Point> points(count);
+        for (int i = 0; i < count; i++)
+        {
+            points[i] = {iterations[i], outcomes[i], norms[i], zx[i], zy[i]};
+        }
+        return points;
+    }
+
+    // Mismatches of one kernel against the scalar orbit. z is only defined for points left bounded, |z|^2 for escaped and bounded ones.
+    long int compare(const char* name, const std::vector<Point>& expected, const std::vector<Point>& actual, const std::vector<double>& realc, double imagc)
+    {
+        long int failures = 0;
+        for (size_t i = 0; i < expected.size(); i++)
+        {
+            const Point& want = expected[i];
+            const Point& got = actual[i];
+            bool same = want.iterations == got.iterations && want.outcome == got.outcome;
+            if (same && (want.outcome == framebuffer::Outcome::Escaped || want.outcome == framebuffer::Outcome::Bounded))
+            {
+                same = want.norm == got.norm;
+            }
+            if (same && want.outcome == framebuffer::Outcome::Bounded)
+            {
+                same = want.zx == got.zx && want.zy == got.zy;
+            }
+            if (!same)
+            {
+                if (failures < 10)
+                {
+                    std::cerr << std::format("{}: c = {:.17g} {:+.17g}i: {} iterations, outcome {}, |z|^2 {}; scalar: {} iterations, outcome {}, |z|^2 {}\n",
+                                             name, realc[i], imagc, got.iterations, static_cast<int>(got.outcome), got.norm,
+                                             want.iterations, static_cast<int>(want.outcome), want.norm);
+                }
+                failures++;
+            }
+        }
+        return failures;
+    }
+
+    struct TestView
+    {
+        const char* name;
+        double real_min;
+        double imag_min;
+        double width;
+        double height;
+        long int columns;
+        long int rows;
+        long int first_limit;
+        long int max_iterations;
+    };
+
+}
+
+int main()
+{
+    const TestView views[] = {
+        {"full-set",        -2.2, -1.3, 3.0, 2.6, 193, 131, 40, 1000},
+        {"seahorse-valley", -0.7461, 0.1293, 0.005, 0.005, 160, 100, 300, 4000},
+        {"interior-edge",   -0.78, -0.02, 0.06, 0.04, 97, 61, 100, 5000},
+    };
+
+    // Points whose orbits land exactly on the escape radius or on the cardioid and bulb boundaries.
+    const std::vector<double> special = {-2.0, 2.0, 0.25, -0.75, -1.25, 0.0, -1.0, 0.5, -2.0000000001, 1e-300};
+
+    std::vector<std::pair<const char*, simd::RowKernel>> kernels = {{simd::isa_name(simd::ISA::Scalar), simd::kernel_for(simd::ISA::Scalar)}};
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        kernels.emplace_back(simd::isa_name(simd::ISA::AVX2), simd::kernel_for(simd::ISA::AVX2));
+    }
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        kernels.emplace_back(simd::isa_name(simd::ISA::AVX512), simd::kernel_for(simd::ISA::AVX512));
+    }
+
+    Mandelbrot mandelbrot;
+    long int failures = 0;
+    long int points = 0;
+    for (const auto& [name, kernel] : kernels)
+    {
+        const std::vector<Point> expected = scalar_row(mandelbrot, special, 0.0, 3, 100);
+        failures += compare(name, expected, kernel_row(kernel, special, 0.0, 3, 100), special, 0.0);
+        points += special.size();
+
+        for (const TestView& view : views)
+        {
+            std::vector<double> realc(view.columns);
+            for (long int x = 0; x < view.columns; x++)
+            {
+                realc[x] = view.real_min + view.width / view.columns * x;
+            }
+            for (long int y = 0; y < view.rows; y++)
+            {
+                const double imagc = view.imag_min + view.height / view.rows * y;
+                const std::vector<Point> expected = scalar_row(mandelbrot, realc, imagc, view.first_limit, view.max_iterations);
+                failures += compare(std::format("{} {}", name, view.name).c_str(), expected, kernel_row(kernel, realc, imagc, view.first_limit, view.max_iterations), realc, imagc);
+                points += view.columns;
+            }
+        }
+    }
+
+    std::cout << std::format("{} kernels, {} points, {} mismatches\n", kernels.size(), points, failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,215 @@
+// Round trips tiles through a TileStore file: tiles appended by one instance are found by the next and by one
+// sharing the file at the same time, a record cut short is skipped and padded over by the next writer, a record
+// whose checksum fails is skipped, an instance that cannot write the file only reads it, and a file that is not
+// a tile store is refused.
+#include <iostream>
+#include <format>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../tile_store.hpp"
+
+
+namespace
+{
+
+    long int failures = 0;
+
+    void check(bool passed, const std::string& what)
+    {
+        if (!passed)
+        {
+            std::cerr << what << "\n";
+            failures++;
+        }
+    }
+
+    store::StoreKey key(int n)
+    {
+        return {0x9e3779b97f4a7c15ull * (n + 1), 0xc2b2ae3d27d4eb4full, 500, 4, 0};
+    }
+
+    // A tile whose every sample tells which key it was stored under.
+    cache::Tile tile(int n)
+    {
+        cache::Tile tile;
+        for (long int i = 0; i < cache::tile_cells; i++)
+        {
+            tile.samples[i] = {static_cast<int32_t>(n * 1000 + i), static_cast<float>(n) + 0.5f, framebuffer::Outcome::Escaped};
+            tile.subsamples[i].iterations[0] = n;
+            tile.subsamples[i].valid = (i % 3) == 0;
+            tile.known[i] = (i + n) % 5 != 0;
+        }
+        return tile;
+    }
+
+    bool holds(const store::TileStore& tile_store, int n)
+    {
+        cache::Tile found;
+        if (!tile_store.find(key(n), found))
+        {
+            return false;
+        }
+        const cache::Tile want = tile(n);
+        for (long int i = 0; i < cache::tile_cells; i++)
+        {
+            if (found.samples[i].iterations != want.samples[i].iterations || found.samples[i].smooth != want.samples[i].smooth
+                || found.subsamples[i].iterations[0] != want.subsamples[i].iterations[0] || found.subsamples[i].valid != want.subsamples[i].valid
+                || found.known[i] != want.known[i])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Appends reach the file in the background, so another instance sees them once a refresh picks them up.
+    bool wait_for(store::TileStore& tile_store, int n)
+    {
+        for (int attempt = 0; attempt < 500 && !holds(tile_store, n); attempt++)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            tile_store.refresh();
+        }
+        return holds(tile_store, n);
+    }
+
+    off_t file_size(const std::string& path)
+    {
+        struct stat status;
+        return ::stat(path.c_str(), &status) == 0 ? status.st_size : -1;
+    }
+
+    bool records_aligned(const std::string& path)
+    {
+        return (file_size(path) - static_cast<off_t>(sizeof(store::FileHeader))) % static_cast<off_t>(sizeof(store::Record)) == 0;
+    }
+
+}
+
+int main()
+{
+    // Root may open any file for writing, which leaves the read only fallback untested, so run as nobody instead.
+    if (::geteuid() == 0 && (::setgid(65534) != 0 || ::setuid(65534) != 0))
+    {
+        std::cerr << "cannot drop root privileges\n";
+        return 1;
+    }
+
+    char directory[] = "/tmp/tile_store_test_XXXXXX";
+    if (::mkdtemp(directory) == nullptr)
+    {
+        std::cerr << "cannot create a temporary directory\n";
+        return 1;
+    }
+    const std::string path = std::string(directory) + "/tiles";
+
+    // One session appends, the next finds its tiles.
+    {
+        store::TileStore writer;
+        check(writer.open(path), "cannot create the store");
+        for (int n = 0; n < 3; n++)
+        {
+            writer.append(key(n), tile(n));
+        }
+    }
+    check(records_aligned(path) && file_size(path) == static_cast<off_t>(sizeof(store::FileHeader) + 3 * sizeof(store::Record)),
+          std::format("store of 3 tiles is {} bytes", file_size(path)));
+    {
+        store::TileStore reader;
+        check(reader.open(path), "cannot reopen the store");
+        check(reader.size() == 3, std::format("reopened store indexes {} tiles, not 3", reader.size()));
+        for (int n = 0; n < 3; n++)
+        {
+            check(holds(reader, n), std::format("tile {} did not survive a reopen", n));
+        }
+        check(!holds(reader, 3), "store finds a tile never stored");
+    }
+
+    // Two instances with descriptors of their own share the file, each finding what the other appends.
+    {
+        store::TileStore first;
+        store::TileStore second;
+        check(first.open(path) && second.open(path), "cannot open the store twice");
+        first.append(key(3), tile(3));
+        check(wait_for(second, 3), "second instance never saw the first one's tile");
+        second.append(key(4), tile(4));
+        check(wait_for(first, 4), "first instance never saw the second one's tile");
+        // The last record for a key is the one that counts.
+        first.append(key(0), tile(5));
+        for (int attempt = 0; attempt < 500 && holds(second, 0); attempt++)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            second.refresh();
+        }
+        cache::Tile replaced;
+        check(second.find(key(0), replaced) && replaced.samples[0].iterations == 5000, "a later record did not replace an earlier one");
+    }
+    check(records_aligned(path), "shared appends left a partial record");
+
+    // A record cut short by a crash is not read, and the next writer pads over it.
+    const off_t whole = file_size(path);
+    check(::truncate(path.c_str(), whole - sizeof(store::Record) / 2) == 0, "cannot truncate the store");
+    {
+        store::TileStore recovered;
+        check(recovered.open(path), "cannot open a store with a truncated record");
+        check(recovered.size() == 5, std::format("store with a truncated record indexes {} tiles, not 5", recovered.size()));
+        cache::Tile replaced;
+        check(recovered.find(key(0), replaced) && replaced.samples[0].iterations == 0, "the truncated record was read");
+        recovered.append(key(6), tile(6));
+    }
+    check(records_aligned(path) && file_size(path) == whole + static_cast<off_t>(sizeof(store::Record)),
+          std::format("append after a truncated record left the store at {} bytes", file_size(path)));
+    {
+        store::TileStore reader;
+        check(reader.open(path) && holds(reader, 6), "tile appended after a truncated record was lost");
+        check(holds(reader, 0), "the truncated record shadows the one before it");
+    }
+
+    // A record whose contents no longer match its checksum is skipped.
+    {
+        const int fd = ::open(path.c_str(), O_WRONLY);
+        const off_t last = file_size(path) - sizeof(store::Record);
+        const unsigned char garbage = 0xff;
+        check(fd >= 0 && ::pwrite(fd, &garbage, 1, last + offsetof(store::Record, samples) + 7) == 1, "cannot corrupt the last record");
+        ::close(fd);
+        store::TileStore reader;
+        cache::Tile found;
+        check(reader.open(path) && !reader.find(key(6), found) && holds(reader, 4), "a corrupted record was read");
+    }
+
+    // An instance that cannot write the file still reads it, and appends nothing.
+    check(::chmod(path.c_str(), 0444) == 0, "cannot make the store read only");
+    {
+        const off_t before = file_size(path);
+        store::TileStore reader;
+        check(reader.open(path), "cannot open a read only store");
+        check(holds(reader, 4) && holds(reader, 3), "read only store lost tiles");
+        reader.append(key(7), tile(7));
+        reader.close();
+        check(file_size(path) == before, "read only store grew");
+    }
+
+    // A file written by something else is refused.
+    const std::string other = std::string(directory) + "/other";
+    {
+        const int fd = ::open(other.c_str(), O_WRONLY | O_CREAT, 0644);
+        const char text[] = "not a tile store, but long enough to hold a header";
+        check(fd >= 0 && ::write(fd, text, sizeof(text)) == static_cast<ssize_t>(sizeof(text)), "cannot write the other file");
+        ::close(fd);
+        store::TileStore reader;
+        check(!reader.open(other), "a file that is not a tile store was opened");
+    }
+
+    std::remove(path.c_str());
+    std::remove(other.c_str());
+    ::rmdir(directory);
+
+    std::cout << std::format("tile store round trip, {} failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -1,163 +1,269 @@
 #pragma once
-#include <queue>
+#include <deque>
 #include <vector>
+#include <memory>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <functional>
 #include <atomic>
+#include <chrono>
 
 
 namespace tp
 {
 
-    struct TaskQueue
+    // Counts outstanding tasks of one batch. wait() blocks, without spinning, until all are done.
+    struct Latch
     {
-        std::queue<std::function<void()>> tasks;
         std::mutex mutex;
-        std::atomic<uint32_t> remaining_tasks = 0;
-        bool pause = false;
+        std::condition_variable done_cv;
+        uint32_t remaining_tasks = 0;
 
-        template<typename Callback_Function>
-        void add_work_queue(Callback_Function&& callback)
+        void add(uint32_t count = 1)
         {
             std::lock_guard<std::mutex> lock_guard{mutex};
-            tasks = std::forward<Callback_Function>(callback);
-            remaining_tasks = callback.size();
+            remaining_tasks += count;
         }
 
-        void get_task(std::function<void()>& target_callback)
+        void count_down()
         {
             std::lock_guard<std::mutex> lock_guard{mutex};
-            if (tasks.empty() | pause) 
+            if (--remaining_tasks == 0)
             {
-                return;
+                done_cv.notify_all();
             }
-            target_callback = std::move(tasks.front());
-            tasks.pop();
         }
 
-        static void wait()
+        void wait()
         {
-            std::this_thread::yield();
+            std::unique_lock<std::mutex> lock{mutex};
+            done_cv.wait(lock, [this](){ return remaining_tasks == 0; });
         }
+    };
 
-        void wait_for_completion() const
-        {
-            while (remaining_tasks > 0) 
-            {
-                wait();
-            }
-        }
+    // Counts a task of a latch down when it goes out of scope, so a task that throws still releases the waiter.
+    struct CountDown
+    {
+        Latch& latch;
 
-        void done()
+        ~CountDown()
         {
-            remaining_tasks--;
+            latch.count_down();
         }
     };
 
-    struct Worker
+    // Per worker deque. The owner works from the back, where its newest and cache warm tasks are,
+    // idle workers steal from the front. Tasks from outside the pool are queued at the front so the
+    // owner still runs them in submission order, while thieves take the last submitted ones.
+    struct TaskQueue
     {
-        uint32_t id = 0;
-        std::thread thread;
-        std::function<void()> task = nullptr;
-        bool running = true;
-        TaskQueue* queue = nullptr;
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+
+        void push(std::function<void()>&& task)
+        {
+            std::lock_guard<std::mutex> lock_guard{mutex};
+            tasks.push_back(std::move(task));
+        }
 
-        Worker() = default;
+        void push_front(std::function<void()>&& task)
+        {
+            std::lock_guard<std::mutex> lock_guard{mutex};
+            tasks.push_front(std::move(task));
+        }
 
-        Worker(TaskQueue& queue, uint32_t id): id{id}, queue{&queue}
+        bool pop(std::function<void()>& target_callback)
         {
-            thread = std::thread([this](){
-                run();
-            });
+            std::lock_guard<std::mutex> lock_guard{mutex};
+            if (tasks.empty())
+            {
+                return false;
+            }
+            target_callback = std::move(tasks.back());
+            tasks.pop_back();
+            return true;
         }
 
-        void run()
+        bool steal(std::function<void()>& target_callback)
         {
-            while (running)
+            std::lock_guard<std::mutex> lock_guard{mutex};
+            if (tasks.empty())
             {
-                queue->get_task(task);
-                if (task == nullptr)
-                {
-                    TaskQueue::wait();
-                }
-                else 
-                {
-                    task();
-                    queue->done();
-                    task = nullptr;
-                }
+                return false;
             }
+            target_callback = std::move(tasks.front());
+            tasks.pop_front();
+            return true;
         }
+    };
 
-        void stop()
+    struct ThreadPool;
+
+    struct Worker
+    {
+        uint32_t id = 0;
+        std::thread thread;
+        TaskQueue queue;
+        ThreadPool* pool = nullptr;
+
+        // Time spent running tasks, for utilisation figures.
+        std::atomic<int64_t> busy_nanoseconds = 0;
+
+        Worker(ThreadPool& pool, uint32_t id): id{id}, pool{&pool}
         {
-            running = false;
-            thread.join();
         }
+
+        void start();
+        void run();
     };
 
     struct ThreadPool
     {
-        uint32_t            thread_count = 0;
-        TaskQueue           queue;
-        std::vector<Worker> workers;
+        uint32_t                             thread_count = 0;
+        std::vector<std::unique_ptr<Worker>> workers;
+
+        // Workers with nothing to run or steal park here until a task is queued.
+        std::mutex              park_mutex;
+        std::condition_variable park_cv;
+        uint32_t                queued_tasks = 0;
+        bool                    stopping = false;
+
+        // Round robin target for tasks queued from outside the pool.
+        std::atomic<uint32_t> next_queue = 0;
+
+        // Worker running on the current thread, if it belongs to a pool.
+        static inline thread_local Worker* current_worker = nullptr;
 
         explicit
         ThreadPool(uint32_t thread_count): thread_count{thread_count}
         {
             workers.reserve(thread_count);
-            for (uint32_t i{thread_count}; i--;) 
+            for (uint32_t i{0}; i < thread_count; ++i)
             {
-                workers.emplace_back(queue, static_cast<uint32_t>(workers.size()));
+                workers.push_back(std::make_unique<Worker>(*this, i));
+            }
+            for (std::unique_ptr<Worker>& worker : workers)
+            {
+                worker->start();
             }
         }
 
         virtual ~ThreadPool()
         {
-            for (Worker& worker : workers) 
             {
-                worker.stop();
+                std::lock_guard<std::mutex> lock_guard{park_mutex};
+                stopping = true;
+            }
+            park_cv.notify_all();
+            for (std::unique_ptr<Worker>& worker : workers)
+            {
+                worker->thread.join();
             }
         }
 
-        template<typename Callback_Function>
-        void add_work_queue(Callback_Function&& callback)
+        // Queue a task counted by the latch. From inside a task it goes onto the calling worker's own deque,
+        // so recursive work stays local until someone idle steals it.
+        // The task is counted before it is queued, a worker taking it at once must not bring the count below zero.
+        void submit(Latch& latch, std::function<void()> task)
         {
-            queue.add_work_queue(std::forward<Callback_Function>(callback));
+            latch.add();
+            std::function<void()> counted = [&latch, task = std::move(task)](){
+                const CountDown count_down{latch};
+                task();
+            };
+
+            {
+                std::lock_guard<std::mutex> lock_guard{park_mutex};
+                queued_tasks++;
+            }
+
+            if (current_worker != nullptr && current_worker->pool == this)
+            {
+                current_worker->queue.push(std::move(counted));
+            }
+            else
+            {
+                workers[next_queue++ % thread_count]->queue.push_front(std::move(counted));
+            }
+            park_cv.notify_one();
         }
 
-        void wait_for_completion() const
+        // Take a task from the worker's own deque, else steal from the others, starting after itself.
+        bool get_task(Worker& worker, std::function<void()>& target_callback)
         {
-            queue.wait_for_completion();
+            bool found = worker.queue.pop(target_callback);
+            for (uint32_t i{1}; !found && i < thread_count; ++i)
+            {
+                found = workers[(worker.id + i) % thread_count]->queue.steal(target_callback);
+            }
+
+            if (found)
+            {
+                std::lock_guard<std::mutex> lock_guard{park_mutex};
+                queued_tasks--;
+            }
+            return found;
         }
 
-        template<typename Callback_Function>
-        void create_work_queue(uint32_t element_count, Callback_Function&& callback)
+        // Block until a task may be available. Returns false once the pool is shutting down.
+        bool park()
         {
-            queue.pause = true;
-            std::queue<std::function<void()>> work_queue;
-
-            const uint32_t batches = thread_count * 2;
+            std::unique_lock<std::mutex> lock{park_mutex};
+            park_cv.wait(lock, [this](){ return stopping || queued_tasks > 0; });
+            return !stopping;
+        }
 
-            const uint32_t batch_size = element_count / batches;
-            for (uint32_t i{0}; i < batches; ++i) 
+        // Time each worker has spent running tasks so far.
+        std::vector<std::chrono::nanoseconds> busy_times() const
+        {
+            std::vector<std::chrono::nanoseconds> times;
+            for (const std::unique_ptr<Worker>& worker : workers)
             {
-                const uint32_t start = batch_size * i;
-                const uint32_t end   = start + batch_size;
-                work_queue.emplace([start, end, &callback](){ callback(start, end); });
+                times.emplace_back(worker->busy_nanoseconds.load());
             }
+            return times;
+        }
 
-            if (batch_size * batches < element_count)
+        // Run the callback once per item and wait for all of them. Items are started in order.
+        template<typename Item, typename Callback_Function>
+        void run_each(const std::vector<Item>& items, Callback_Function&& callback)
+        {
+            Latch latch;
+            next_queue = 0;
+            for (const Item& item : items)
             {
-                const uint32_t start = batch_size * batches;
-                callback(start, element_count);
+                submit(latch, [&item, &callback](){ callback(item); });
             }
-
-            add_work_queue(work_queue);
-            queue.pause = false;
-            wait_for_completion();
+            latch.wait();
         }
     };
 
-}
\ No newline at end of file
+    inline void Worker::start()
+    {
+        thread = std::thread([this](){
+            run();
+        });
+    }
+
+    inline void Worker::run()
+    {
+        ThreadPool::current_worker = this;
+        std::function<void()> task;
+        while (true)
+        {
+            if (pool->get_task(*this, task))
+            {
+                const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                task();
+                task = nullptr;
+                busy_nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            }
+            else if (!pool->park())
+            {
+                return;
+            }
+        }
+    }
+
+}
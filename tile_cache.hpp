@@ -0,0 +1,142 @@
+#pragma once
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include "framebuffer.hpp"
+
+
+namespace cache
+{
+
+    // Size of a cached tile in cells.
+    constexpr long int tile_width = 32;
+    constexpr long int tile_height = 16;
+    constexpr long int tile_cells = tile_width * tile_height;
+
+    // Which cells a tile holds. Cells sit on a lattice of the plane that stays put while the view pans and that every
+    // zoom level shares the origin of, see Mandelbrot::place. A tile is a tile_width by tile_height block of it at
+    // one level, for one grid size, iteration limit and backend, since all of those change the cells' values.
+    struct TileKey
+    {
+        uint64_t lattice = 0;
+        long int level = 0;
+        long int columns = 0;
+        long int rows = 0;
+        long int max_iterations = 0;
+        int backend = 0;
+        long int tile_x = 0;
+        long int tile_y = 0;
+
+        bool operator==(const TileKey&) const = default;
+    };
+
+    struct TileKeyHash
+    {
+        size_t operator()(const TileKey& key) const
+        {
+            uint64_t hash = 0xcbf29ce484222325;
+            for (uint64_t field : {key.lattice, static_cast<uint64_t>(key.level), static_cast<uint64_t>(key.columns), static_cast<uint64_t>(key.rows),
+                                   static_cast<uint64_t>(key.max_iterations), static_cast<uint64_t>(key.backend),
+                                   static_cast<uint64_t>(key.tile_x), static_cast<uint64_t>(key.tile_y)})
+            {
+                hash = (hash ^ field) * 0x100000001b3;
+                hash ^= hash >> 29;
+            }
+            return hash;
+        }
+    };
+
+    // Final samples of a tile's cells, row-major. A tile seen only partly on screen holds the cells that were.
+    struct Tile
+    {
+        std::vector<framebuffer::Sample> samples = std::vector<framebuffer::Sample>(tile_cells);
+        std::vector<framebuffer::Subsamples> subsamples = std::vector<framebuffer::Subsamples>(tile_cells);
+        std::vector<uint8_t> known = std::vector<uint8_t>(tile_cells, 0);
+    };
+
+    // Memory a tile takes, bookkeeping included.
+    constexpr size_t tile_bytes = sizeof(Tile) + sizeof(TileKey) + tile_cells * (sizeof(framebuffer::Sample) + sizeof(framebuffer::Subsamples) + 1) + 64;
+
+    //
+    // Least recently used tiles, up to a memory budget. Used from one thread only, so not synchronized.
+    //
+    class TileCache
+    {
+        public:
+        explicit
+        TileCache(size_t budget = 0): budget(budget)
+        {
+        }
+
+        bool enabled() const
+        {
+            return budget >= tile_bytes;
+        }
+
+        void set_budget(size_t bytes)
+        {
+            budget = bytes;
+            evict();
+        }
+
+        // The tile, marked as just used, or nullptr.
+        Tile* find(const TileKey& key)
+        {
+            const auto found = index.find(key);
+            if (found == index.end())
+            {
+                return nullptr;
+            }
+            tiles.splice(tiles.begin(), tiles, found->second);
+            return &found->second->second;
+        }
+
+        // The tile to store cells in, a new empty one if it is not cached. The least recently used tiles make room for it.
+        Tile& store(const TileKey& key)
+        {
+            if (Tile* tile = find(key))
+            {
+                return *tile;
+            }
+            tiles.emplace_front(key, Tile{});
+            index.emplace(key, tiles.begin());
+            evict();
+            return tiles.front().second;
+        }
+
+        void clear()
+        {
+            tiles.clear();
+            index.clear();
+        }
+
+        size_t size() const
+        {
+            return tiles.size();
+        }
+
+        size_t bytes() const
+        {
+            return tiles.size() * tile_bytes;
+        }
+
+        private:
+        size_t budget;
+        std::list<std::pair<TileKey, Tile>> tiles;
+        std::unordered_map<TileKey, std::list<std::pair<TileKey, Tile>>::iterator, TileKeyHash> index;
+
+        // Drop the oldest tiles over the budget, never the one just stored.
+        void evict()
+        {
+            while (tiles.size() > 1 && bytes() > budget)
+            {
+                index.erase(tiles.back().first);
+                tiles.pop_back();
+            }
+        }
+    };
+
+}
@@ -0,0 +1,206 @@
+#pragma once
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+
+
+namespace tiles
+{
+
+    // Move a grid's contents by (dx, dy) cells: cell (x, y) takes the value of cell (x + dx, y + dy).
+    // Cells whose source lies outside the grid are set to `fill`.
+    template<typename T>
+    void shift_cells(std::vector<T>& cells, long int width, long int height, long int dx, long int dy, const T& fill)
+    {
+        std::vector<T> shifted(cells.size(), fill);
+        for (long int y = std::max(0L, -dy); y < std::min(height, height - dy); y++)
+        {
+            const long int x0 = std::max(0L, -dx);
+            const long int x1 = std::min(width, width - dx);
+            if (x0 < x1)
+            {
+                std::copy(cells.begin() + (y + dy) * width + x0 + dx, cells.begin() + (y + dy) * width + x1 + dx, shifted.begin() + y * width + x0);
+            }
+        }
+        cells.swap(shifted);
+    }
+
+    // Rectangle of buffer cells, [x0, x1) by [y0, y1).
+    struct Tile
+    {
+        long int x0 = 0;
+        long int y0 = 0;
+        long int x1 = 0;
+        long int y1 = 0;
+
+        // Expected render time in nanoseconds, from the previous frame.
+        double predicted_cost = 0.0;
+
+        long int width() const { return x1 - x0; }
+        long int height() const { return y1 - y0; }
+        long int area() const { return width() * height(); }
+    };
+
+    //
+    // Cuts the buffer into 2D tiles sized by how long each region took in the previous frame.
+    // Expensive regions (the set's interior) are split until no tile is a large share of the frame,
+    // and tiles are handed out most expensive first so the frame ends on cheap ones.
+    //
+    struct TileScheduler
+    {
+        // Tile size used while there is no timing history, and the smallest a tile is ever split to.
+        static constexpr long int base_width = 16;
+        static constexpr long int base_height = 8;
+        static constexpr long int min_width = 4;
+        static constexpr long int min_height = 2;
+
+        // Each worker should get at least this many tiles worth of the predicted frame cost.
+        static constexpr double tiles_per_thread = 8.0;
+
+        long int width = 0;
+        long int height = 0;
+        bool has_history = false;
+
+        // Nanoseconds per cell measured in the previous frame, and its summed-area table.
+        std::vector<float> cell_cost;
+        std::vector<double> cost_table;
+
+        // Forget the timings, e.g. after a resize or when the iteration count changed.
+        void reset(long int buffer_width, long int buffer_height)
+        {
+            width = buffer_width;
+            height = buffer_height;
+            has_history = false;
+            cell_cost.assign(width * height, 0.0f);
+        }
+
+        std::vector<Tile> plan(long int buffer_width, long int buffer_height, uint32_t thread_count)
+        {
+            if (buffer_width != width || buffer_height != height)
+            {
+                reset(buffer_width, buffer_height);
+            }
+
+            std::vector<Tile> tiles;
+            if (!has_history)
+            {
+                for (long int y = 0; y < height; y += base_height)
+                {
+                    for (long int x = 0; x < width; x += base_width)
+                    {
+                        tiles.push_back({x, y, std::min(x + base_width, width), std::min(y + base_height, height)});
+                    }
+                }
+                return tiles;
+            }
+
+            build_cost_table();
+            const double target = cost_of(0, 0, width, height) / (thread_count * tiles_per_thread);
+
+            // Start coarse, 4x the base tile, and split anything predicted above the target.
+            for (long int y = 0; y < height; y += base_height * 4)
+            {
+                for (long int x = 0; x < width; x += base_width * 4)
+                {
+                    split({x, y, std::min(x + base_width * 4, width), std::min(y + base_height * 4, height)}, target, tiles);
+                }
+            }
+
+            std::sort(tiles.begin(), tiles.end(), [](const Tile& a, const Tile& b){ return a.predicted_cost > b.predicted_cost; });
+            return tiles;
+        }
+
+        // Store how long a tile took, spread evenly over its cells. Tiles never overlap, so workers can record concurrently.
+        void record(const Tile& tile, std::chrono::nanoseconds elapsed)
+        {
+            const float per_cell = static_cast<float>(elapsed.count()) / tile.area();
+            for (long int y = tile.y0; y < tile.y1; y++)
+            {
+                std::fill(cell_cost.begin() + y * width + tile.x0, cell_cost.begin() + y * width + tile.x1, per_cell);
+            }
+        }
+
+        // Time the marked cells are predicted to take on thread_count workers, from the previous frame's timings.
+        std::chrono::nanoseconds predict(const std::vector<uint8_t>& cells, uint32_t thread_count) const
+        {
+            if (!has_history || cells.size() != cell_cost.size())
+            {
+                return std::chrono::nanoseconds{0};
+            }
+            double total = 0.0;
+            for (size_t i = 0; i < cells.size(); i++)
+            {
+                if (cells[i]) { total += cell_cost[i]; }
+            }
+            return std::chrono::nanoseconds{static_cast<long int>(total / std::max(1u, thread_count))};
+        }
+
+        // Follow a pan of the view, newly exposed cells are assumed to cost the average.
+        void shift(long int dx, long int dy)
+        {
+            if (cell_cost.empty())
+            {
+                return;
+            }
+            double total = 0.0;
+            for (float cost : cell_cost) { total += cost; }
+            shift_cells(cell_cost, width, height, dx, dy, static_cast<float>(total / cell_cost.size()));
+        }
+
+        // Call once every tile of a frame was recorded.
+        void frame_done()
+        {
+            has_history = true;
+        }
+
+        private:
+        void build_cost_table()
+        {
+            cost_table.assign((width + 1) * (height + 1), 0.0);
+            for (long int y = 0; y < height; y++)
+            {
+                double row = 0.0;
+                for (long int x = 0; x < width; x++)
+                {
+                    row += cell_cost[y * width + x];
+                    cost_table[(y + 1) * (width + 1) + x + 1] = cost_table[y * (width + 1) + x + 1] + row;
+                }
+            }
+        }
+
+        double cost_of(long int x0, long int y0, long int x1, long int y1) const
+        {
+            const long int stride = width + 1;
+            return cost_table[y1 * stride + x1] - cost_table[y0 * stride + x1] - cost_table[y1 * stride + x0] + cost_table[y0 * stride + x0];
+        }
+
+        void split(Tile tile, double target, std::vector<Tile>& tiles) const
+        {
+            tile.predicted_cost = cost_of(tile.x0, tile.y0, tile.x1, tile.y1);
+
+            const bool can_split_x = tile.width() >= min_width * 2;
+            const bool can_split_y = tile.height() >= min_height * 2;
+            if (tile.predicted_cost <= target || (!can_split_x && !can_split_y))
+            {
+                tiles.push_back(tile);
+                return;
+            }
+
+            // Halve along the longer side, measured in pixels of roughly 2:1 terminal cells.
+            if (can_split_x && (!can_split_y || tile.width() >= tile.height() * 2))
+            {
+                const long int mid = tile.x0 + tile.width() / 2;
+                split({tile.x0, tile.y0, mid, tile.y1}, target, tiles);
+                split({mid, tile.y0, tile.x1, tile.y1}, target, tiles);
+            }
+            else
+            {
+                const long int mid = tile.y0 + tile.height() / 2;
+                split({tile.x0, tile.y0, tile.x1, mid}, target, tiles);
+                split({tile.x0, mid, tile.x1, tile.y1}, target, tiles);
+            }
+        }
+    };
+
+}
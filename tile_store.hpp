@@ -0,0 +1,378 @@
+#pragma once
+#include <string>
+#include <format>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <gmpxx.h>
+#include "./mpreal.h"
+#include "framebuffer.hpp"
+#include "tile_cache.hpp"
+
+
+namespace store
+{
+
+    // FNV-1a, for the keys and the records' checksums.
+    inline uint64_t fnv1a(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; i++)
+        {
+            hash = (hash ^ bytes[i]) * 0x100000001b3;
+        }
+        return hash;
+    }
+
+    // Where a point is, in 1024ths of a cell from 0. Views whose cells lie on the same points, to well within a cell, agree on it.
+    inline std::string cell_position(const mpfr::mpreal& point, const mpfr::mpreal& cell)
+    {
+        mpfr::mpreal position(0.0, std::max(point.get_prec(), cell.get_prec()) + 32);
+        mpfr_div(position.mpfr_ptr(), point.mpfr_srcptr(), cell.mpfr_srcptr(), MPFR_RNDN);
+        mpfr_mul_2si(position.mpfr_ptr(), position.mpfr_srcptr(), 10, MPFR_RNDN);
+        mpz_class whole;
+        mpfr_get_z(whole.get_mpz_t(), position.mpfr_srcptr(), MPFR_RNDN);
+        return whole.get_str(16);
+    }
+
+    // A cell size to 40 significant bits and its binary exponent, which a double could not hold past 1e-308.
+    inline std::string cell_size(const mpfr::mpreal& size)
+    {
+        long exponent = 0;
+        const double mantissa = mpfr_get_d_2exp(&exponent, size.mpfr_srcptr(), MPFR_RNDN);
+        return std::format("{}p{}", std::llround(std::ldexp(mantissa, 40)), exponent);
+    }
+
+    // Identifies a stored tile by what its cells are, not by the session's lattice: the position of its top left cell,
+    // the cell size, the iteration limit, the backend and whether the cells were distance estimated.
+    struct StoreKey
+    {
+        uint64_t point = 0;
+        uint64_t scale = 0;
+        int64_t max_iterations = 0;
+        int32_t backend = 0;
+        int32_t distance = 0;
+
+        bool operator==(const StoreKey&) const = default;
+    };
+
+    struct StoreKeyHash
+    {
+        size_t operator()(const StoreKey& key) const
+        {
+            return fnv1a(&key, sizeof(key));
+        }
+    };
+
+    inline StoreKey key_for(const mpfr::mpreal& real, const mpfr::mpreal& imag, const mpfr::mpreal& cell_width, const mpfr::mpreal& cell_height,
+                            long int max_iterations, int backend, bool distance)
+    {
+        const std::string point = cell_position(real, cell_width) + "," + cell_position(imag, cell_height);
+        const std::string scale = cell_size(cell_width) + "," + cell_size(cell_height);
+        return {fnv1a(point.data(), point.size()), fnv1a(scale.data(), scale.size()), max_iterations, backend, distance};
+    }
+
+    // One tile as written to the file. The checksum covers everything after it.
+    struct Record
+    {
+        StoreKey key;
+        uint64_t checksum = 0;
+        uint8_t known[cache::tile_cells];
+        framebuffer::Sample samples[cache::tile_cells];
+        framebuffer::Subsamples subsamples[cache::tile_cells];
+
+        uint64_t sum() const
+        {
+            return fnv1a(known, sizeof(Record) - offsetof(Record, known), fnv1a(&key, sizeof(key)));
+        }
+    };
+
+    // Start of the file. A file written by a build with other records is not read.
+    struct FileHeader
+    {
+        char magic[8] = {'A', 'M', 'T', 'I', 'L', 'E', 'S', '2'};
+        uint32_t record_size = sizeof(Record);
+        uint32_t tile_width = cache::tile_width;
+        uint32_t tile_height = cache::tile_height;
+        uint32_t reserved = 0;
+
+        bool operator==(const FileHeader&) const = default;
+    };
+
+    //
+    // Tiles kept on disk across sessions, in a file any number of instances may read and append to at once.
+    // The file is a header and records, only ever appended, the last record for a key being the one that counts.
+    // It is mapped read only and indexed in memory, and the index picks up what other instances appended on
+    // each refresh(). Records are appended in the background, each in one write under an exclusive flock, and
+    // read under a shared one, so a record being written is never indexed. A record cut short by a crash fails
+    // its checksum and the next writer pads over it.
+    // find(), append() and refresh() are for one thread.
+    //
+    class TileStore
+    {
+        public:
+        // The file stops growing past this.
+        static constexpr size_t max_file_bytes = size_t{1} << 30;
+
+        // Records waiting to be written past this are dropped, they are only a cache.
+        static constexpr size_t max_queued = 256;
+
+        TileStore() = default;
+        TileStore(const TileStore&) = delete;
+        TileStore& operator=(const TileStore&) = delete;
+
+        ~TileStore()
+        {
+            close();
+        }
+
+        // Open or create the file. One that can only be read is used read only.
+        bool open(const std::string& path)
+        {
+            read_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            writable = read_fd >= 0;
+            if (!writable)
+            {
+                read_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            }
+            if (read_fd < 0)
+            {
+                return false;
+            }
+
+            // The writer appends through a descriptor of its own, flock() locks held through one are not shared with the other.
+            if (writable)
+            {
+                write_fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+                if (write_fd < 0 || !write_header())
+                {
+                    close();
+                    return false;
+                }
+            }
+
+            FileHeader header;
+            if (::pread(read_fd, &header, sizeof(header), 0) != sizeof(header) || !(header == FileHeader{}))
+            {
+                close();
+                return false;
+            }
+            scanned = sizeof(FileHeader);
+            refresh();
+
+            if (writable)
+            {
+                writer = std::thread(&TileStore::write_loop, this);
+            }
+            return true;
+        }
+
+        bool is_open() const
+        {
+            return read_fd >= 0;
+        }
+
+        // Map and index what was appended since the last refresh.
+        void refresh()
+        {
+            struct stat status;
+            if (read_fd < 0 || ::fstat(read_fd, &status) != 0 || static_cast<size_t>(status.st_size) < scanned + sizeof(Record))
+            {
+                return;
+            }
+
+            ::flock(read_fd, LOCK_SH);
+            ::fstat(read_fd, &status);
+            unmap();
+            void* address = ::mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, read_fd, 0);
+            if (address != MAP_FAILED)
+            {
+                map = static_cast<const unsigned char*>(address);
+                mapped = status.st_size;
+                for (; scanned + sizeof(Record) <= mapped; scanned += sizeof(Record))
+                {
+                    const Record& record = *reinterpret_cast<const Record*>(map + scanned);
+                    if (record.checksum == record.sum())
+                    {
+                        index[record.key] = scanned;
+                    }
+                }
+            }
+            ::flock(read_fd, LOCK_UN);
+        }
+
+        // Copy the stored tile into `tile`, if there is one.
+        bool find(const StoreKey& key, cache::Tile& tile) const
+        {
+            const auto found = index.find(key);
+            if (found == index.end())
+            {
+                return false;
+            }
+            const Record& record = *reinterpret_cast<const Record*>(map + found->second);
+            std::copy_n(record.known, cache::tile_cells, tile.known.begin());
+            std::copy_n(record.samples, cache::tile_cells, tile.samples.begin());
+            std::copy_n(record.subsamples, cache::tile_cells, tile.subsamples.begin());
+            return true;
+        }
+
+        // Queue the tile to be appended.
+        void append(const StoreKey& key, const cache::Tile& tile)
+        {
+            if (!writable)
+            {
+                return;
+            }
+            std::unique_ptr<Record> record = std::make_unique<Record>();
+            std::memset(static_cast<void*>(record.get()), 0, sizeof(Record));
+            record->key = key;
+            std::copy_n(tile.known.begin(), cache::tile_cells, record->known);
+            std::copy_n(tile.samples.begin(), cache::tile_cells, record->samples);
+            std::copy_n(tile.subsamples.begin(), cache::tile_cells, record->subsamples);
+            record->checksum = record->sum();
+            {
+                std::lock_guard<std::mutex> lock_guard{mutex};
+                if (queue.size() >= max_queued)
+                {
+                    return;
+                }
+                queue.push_back(std::move(record));
+            }
+            queue_cv.notify_one();
+        }
+
+        // Tiles indexed.
+        size_t size() const
+        {
+            return index.size();
+        }
+
+        // Write out what is queued and close the file.
+        void close()
+        {
+            if (writer.joinable())
+            {
+                {
+                    std::lock_guard<std::mutex> lock_guard{mutex};
+                    stopping = true;
+                }
+                queue_cv.notify_all();
+                writer.join();
+            }
+            unmap();
+            for (int* fd : {&read_fd, &write_fd})
+            {
+                if (*fd >= 0)
+                {
+                    ::close(*fd);
+                    *fd = -1;
+                }
+            }
+            index.clear();
+        }
+
+        private:
+        int read_fd = -1;
+        int write_fd = -1;
+        bool writable = false;
+
+        const unsigned char* map = nullptr;
+        size_t mapped = 0;
+        size_t scanned = 0;
+        std::unordered_map<StoreKey, size_t, StoreKeyHash> index;
+
+        std::thread writer;
+        std::mutex mutex;
+        std::condition_variable queue_cv;
+        std::deque<std::unique_ptr<Record>> queue;
+        bool stopping = false;
+
+        void unmap()
+        {
+            if (map != nullptr)
+            {
+                ::munmap(const_cast<unsigned char*>(map), mapped);
+                map = nullptr;
+                mapped = 0;
+            }
+        }
+
+        static bool write_all(int fd, const void* data, size_t size)
+        {
+            const unsigned char* bytes = static_cast<const unsigned char*>(data);
+            while (size > 0)
+            {
+                const ssize_t written = ::write(fd, bytes, size);
+                if (written <= 0)
+                {
+                    return false;
+                }
+                bytes += written;
+                size -= written;
+            }
+            return true;
+        }
+
+        // Give a new, empty, file its header. Whoever gets the lock first writes it.
+        bool write_header()
+        {
+            ::flock(write_fd, LOCK_EX);
+            struct stat status;
+            bool good = ::fstat(write_fd, &status) == 0;
+            if (good && status.st_size == 0)
+            {
+                const FileHeader header;
+                good = write_all(write_fd, &header, sizeof(header));
+            }
+            ::flock(write_fd, LOCK_UN);
+            return good;
+        }
+
+        void write_loop()
+        {
+            while (true)
+            {
+                std::unique_ptr<Record> record;
+                {
+                    std::unique_lock<std::mutex> lock{mutex};
+                    queue_cv.wait(lock, [this](){ return stopping || !queue.empty(); });
+                    if (queue.empty())
+                    {
+                        return;
+                    }
+                    record = std::move(queue.front());
+                    queue.pop_front();
+                }
+
+                ::flock(write_fd, LOCK_EX);
+                struct stat status;
+                if (::fstat(write_fd, &status) == 0 && static_cast<size_t>(status.st_size) < max_file_bytes)
+                {
+                    // Pad over a record a crashed writer left unfinished, so this one starts on a record boundary.
+                    const size_t partial = (status.st_size - sizeof(FileHeader)) % sizeof(Record);
+                    const std::vector<unsigned char> padding(partial > 0 ? sizeof(Record) - partial : 0, 0);
+                    if (padding.empty() || write_all(write_fd, padding.data(), padding.size()))
+                    {
+                        write_all(write_fd, record.get(), sizeof(Record));
+                    }
+                }
+                ::flock(write_fd, LOCK_UN);
+            }
+        }
+    };
+
+}